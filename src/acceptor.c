@@ -0,0 +1,426 @@
+/* acceptor.c  SO_REUSEPORT acceptor processes
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * With -aN, server() forks N acceptor() processes that listen on Port
+ * next to it with SO_REUSEPORT, so the kernel spreads new connections
+ * over N + 1 processes.  An acceptor steps handshakes with gettx():
+ * OP_HELLO, crc, id and pink list checks.  Then acc_request() puts an
+ * OP_TX in the acceptor's ring in shared memory, and hands any other
+ * request to server() with its socket over a socketpair (SCM_RIGHTS).
+ * Pink list verdicts go through the ring too, since only server()
+ * adds to Peers[].  An acceptor takes connect tokens from Peers[]
+ * itself, and a connect from an IP not in it yet goes in the ring for
+ * server() to add and charge.  server() drains all of it in
+ * acc_poll().  A ring
+ * TX has had its crc and opcode checked, so acc_poll() only queues it
+ * with tx_recv().  If the ring is full, the TX goes over the socketpair
+ * like any other request, and what cannot go either way is counted.
+ *
+ * The chain tip an acceptor puts in OP_HELLO_ACK is the one server()
+ * keeps in Acctip with acc_tip() after each update().
+ *
+ * Each ring has one writer and one reader, so head and tail need
+ * only memory barriers and no locks.
+*/
+
+
+#define AQ_TX     0   /* OP_TX request */
+#define AQ_PINK   1   /* pinklist() src_ip */
+#define AQ_EPINK  2   /* epinklist() src_ip */
+#define AQ_CONNECT 3  /* peer_take() PT_CONNECT for a new src_ip */
+
+typedef struct {
+   int kind;          /* AQ_TX, AQ_PINK, AQ_EPINK, or AQ_CONNECT */
+   NODE node;         /* request as read by gettx() */
+} ACCMSG;
+
+typedef struct {
+   volatile word32 head;   /* written by acceptor() */
+   volatile word32 tail;   /* written by server() */
+   volatile word32 lost;   /* requests dropped -- by acceptor() */
+   ACCMSG msg[ACCQLEN];
+} ACCRING;
+
+typedef struct {
+   volatile word32 seq;    /* odd while server() writes it */
+   byte cblock[8];
+   byte cblockhash[HASHLEN];
+   byte prevhash[HASHLEN];
+   byte weight[HASHLEN];
+} ACCTIP;
+
+ACCRING *Accring;              /* Acceptors rings in shared memory */
+ACCTIP *Acctip;                /* chain tip of server(), shared too */
+word32 Nacclost;               /* sum of lost in server() */
+SOCKET Accsp[MAXACCEPT][2];    /* [0] in server(), [1] in acceptor() */
+SOCKET Acclsd;                 /* listening socket of server() */
+
+
+/* Put a message in the ring of this acceptor().
+ * Returns VEOK, or VERROR if the ring is full.
+ */
+int acc_push(int kind, NODE *np)
+{
+   ACCRING *rp;
+   ACCMSG *mp;
+
+   rp = &Accring[Acceptor - 1];
+   if(rp->head - rp->tail >= ACCQLEN) {
+      if(Trace) plog("acc_push(): ring full");
+      return VERROR;
+   }
+   mp = &rp->msg[rp->head % ACCQLEN];
+   mp->kind = kind;
+   memcpy(&mp->node, np, sizeof(NODE));
+   __sync_synchronize();  /* message before head */
+   rp->head++;
+   return VEOK;
+}  /* end acc_push() */
+
+
+/* Push a message of kind about ip alone. */
+int acc_ip(int kind, word32 ip)
+{
+   NODE node;
+
+   memset(&node, 0, sizeof(NODE));
+   node.src_ip = ip;
+   return acc_push(kind, &node);
+}
+
+
+/* pinklist() or epinklist() ip in server()  -- in acceptor() */
+int acc_pink(word32 ip, int epoch)
+{
+   return acc_ip(epoch ? AQ_EPINK : AQ_PINK, ip);
+}
+
+
+/* Charge a connect from ip, not in Peers[] yet, in server().
+ * Returns VEOK, or VERROR if the ring is full.  -- in acceptor()
+ */
+int acc_connect(word32 ip)
+{
+   return acc_ip(AQ_CONNECT, ip);
+}
+
+
+/* Hand np and its socket to server().
+ * Returns VEOK, or VERROR if server() cannot take it now.
+ */
+int acc_pass(NODE *np)
+{
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr *cp;
+   union {
+      struct cmsghdr h;
+      char buff[CMSG_SPACE(sizeof(int))];
+   } ctl;
+
+   memset(&msg, 0, sizeof(msg));
+   iov.iov_base = np;
+   iov.iov_len = sizeof(NODE);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = ctl.buff;
+   msg.msg_controllen = sizeof(ctl.buff);
+   cp = CMSG_FIRSTHDR(&msg);
+   cp->cmsg_level = SOL_SOCKET;
+   cp->cmsg_type = SCM_RIGHTS;
+   cp->cmsg_len = CMSG_LEN(sizeof(int));
+   memcpy(CMSG_DATA(cp), &np->sd, sizeof(int));
+   if(sendmsg(Accsp[Acceptor - 1][1], &msg, MSG_DONTWAIT) != sizeof(NODE)) {
+      if(Trace) plog("acc_pass(): cannot pass opcode %d", np->opcode);
+      return VERROR;
+   }
+   return VEOK;
+}  /* end acc_pass() */
+
+
+/* Take a request handed over by acceptor j into Hsnodes[] slot np.
+ * Returns VEOK, or VERROR if there is none.
+ */
+int acc_recv(int j, NODE *np)
+{
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr *cp;
+   union {
+      struct cmsghdr h;
+      char buff[CMSG_SPACE(sizeof(int))];
+   } ctl;
+   int count;
+
+   memset(&msg, 0, sizeof(msg));
+   iov.iov_base = np;
+   iov.iov_len = sizeof(NODE);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = ctl.buff;
+   msg.msg_controllen = sizeof(ctl.buff);
+   count = recvmsg(Accsp[j][0], &msg, MSG_DONTWAIT);
+   if(count < 0) return VERROR;
+   cp = CMSG_FIRSTHDR(&msg);
+   if(cp == NULL || cp->cmsg_type != SCM_RIGHTS) return VERROR;
+   memcpy(&np->sd, CMSG_DATA(cp), sizeof(int));
+   if(count != sizeof(NODE)) {
+      closesocket(np->sd);
+      return VERROR;
+   }
+   return VEOK;
+}  /* end acc_recv() */
+
+
+/* Publish the chain tip after update()  -- in server() */
+void acc_tip(void)
+{
+   if(Acctip == NULL) return;
+   Acctip->seq++;
+   __sync_synchronize();  /* seq before tip */
+   put64(Acctip->cblock, Cblocknum);
+   memcpy(Acctip->cblockhash, Cblockhash, HASHLEN);
+   memcpy(Acctip->prevhash, Prevhash, HASHLEN);
+   memcpy(Acctip->weight, Weight, HASHLEN);
+   __sync_synchronize();  /* tip before seq */
+   Acctip->seq++;
+}  /* end acc_tip() */
+
+
+/* Copy the chain tip of server() in for settxhdr()  -- in acceptor() */
+void acc_gettip(void)
+{
+   ACCTIP tip;
+   word32 seq;
+   int j;
+
+   for(j = 0; j < 100; j++) {
+      seq = Acctip->seq;
+      if(seq & 1) continue;  /* being written */
+      __sync_synchronize();  /* seq before tip */
+      memcpy(&tip, (void *) Acctip, sizeof(ACCTIP));
+      __sync_synchronize();  /* tip before seq again */
+      if(Acctip->seq != seq) continue;
+      put64(Cblocknum, tip.cblock);
+      memcpy(Cblockhash, tip.cblockhash, HASHLEN);
+      memcpy(Prevhash, tip.prevhash, HASHLEN);
+      memcpy(Weight, tip.weight, HASHLEN);
+      return;
+   }
+}  /* end acc_gettip() */
+
+
+/* Called by gettx() in acceptor() with a valid request in np.
+ * Returns -1 to keep np, else 1 to close our copy of the socket.
+ */
+int acc_request(NODE *np)
+{
+   if(np->opcode == OP_TX && acc_push(AQ_TX, np) == VEOK)
+      return hs_keep(np);  /* read the next TX here */
+   if(acc_pass(np) != VEOK) Accring[Acceptor - 1].lost++;
+   return 1;
+}
+
+
+/* Run handshakes on our own SO_REUSEPORT socket lsd until server()
+ * is gone or we get SIGTERM.  Does not return.
+ */
+void acceptor(SOCKET lsd)
+{
+   struct pollfd pfd[HSLEN + 1];
+   NODE *hp;
+   SOCKET nsd;
+   pid_t ppid;
+   int n;
+
+   ppid = getppid();
+   show("acceptor");
+   while(Running && getppid() == ppid) {
+      for(hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++) {
+         if(hp->state != HS_IDLE) continue;
+         if((nsd = accept(lsd, NULL, NULL)) == INVALID_SOCKET) break;
+         nonblock(nsd);
+         if(hs_open(hp, nsd) != VEOK) closesocket(nsd);
+      }
+      for(hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++) {
+         if(hp->state == HS_IDLE) continue;
+         if(gettx(hp) == -1) continue;
+         hp->state = HS_IDLE;
+         closesocket(hp->sd);
+      }
+      /* sleep until there is something to read */
+      pfd[0].fd = lsd;
+      pfd[0].events = POLLIN;
+      for(n = 1, hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++) {
+         if(hp->state == HS_IDLE) continue;
+         pfd[n].fd = hp->sd;
+         pfd[n++].events = POLLIN;
+      }
+      poll(pfd, n, 1000);  /* wake up for deadlines */
+   }  /* end while */
+   hs_closeall();
+   exit(0);
+}  /* end acceptor() */
+
+
+/* Start acceptor j on a new listening socket.
+ * Returns its pid, or zero on error.
+ */
+pid_t acc_fork(int j)
+{
+   struct sockaddr_in addr;
+   SOCKET lsd;
+   pid_t pid;
+   int k, on = 1;
+
+   lsd = socket(AF_INET, SOCK_STREAM, 0);
+   if(lsd == INVALID_SOCKET) {
+      error("acc_fork(): cannot open listening socket");
+      return 0;
+   }
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_port = htons(Port);
+   addr.sin_addr.s_addr = INADDR_ANY;
+   addr.sin_family = AF_INET;
+#ifdef SO_REUSEPORT
+   setsockopt(lsd, SOL_SOCKET, SO_REUSEPORT, (void *) &on, sizeof(on));
+#endif
+   if(bind(lsd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+      || nonblock(lsd) == -1 || listen(lsd, LQLEN) != 0) {
+      error("acc_fork(): cannot listen on port %d", Port);
+      closesocket(lsd);
+      return 0;
+   }
+   pid = fork();
+   if(pid == 0) {
+      /* in acceptor */
+      Acceptor = j + 1;
+      Bcpid = Mpid = Mqpid = Mspid = Cupid = Sendfound_pid = 0;  /* not ours */
+      memset(Apid, 0, sizeof(Apid));
+      closesocket(Acclsd);
+      for(k = 0; k < Acceptors; k++) {
+         closesocket(Accsp[k][0]);
+         if(k != j) closesocket(Accsp[k][1]);
+      }
+      hs_closeall();
+      acceptor(lsd);
+   }
+   closesocket(lsd);  /* a dead acceptor must not keep it */
+   if(pid == -1) {
+      error("acc_fork(): cannot fork()");
+      return 0;
+   }
+   if(Trace) plog("acceptor %d started", j + 1);
+   return pid;
+}  /* end acc_fork() */
+
+
+/* Set up and start Acceptors acceptor()'s next to server() listening
+ * socket lsd.  Returns VEOK, or VERROR to run without them.
+ */
+int acc_init(SOCKET lsd)
+{
+   int j;
+
+#ifndef SO_REUSEPORT
+   Acceptors = 0;
+   return error("acc_init(): SO_REUSEPORT is not supported");
+#endif
+   if(Acceptors > MAXACCEPT) Acceptors = MAXACCEPT;
+   Acclsd = lsd;
+   Accring = mmap(NULL, Acceptors * sizeof(ACCRING), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   Acctip = mmap(NULL, sizeof(ACCTIP), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(Accring == MAP_FAILED || Acctip == MAP_FAILED
+      || pink_share() != VEOK) {
+      Acctip = NULL;
+      Acceptors = 0;
+      return error("acc_init(): cannot mmap() shared memory");
+   }
+   acc_tip();
+   for(j = 0; j < Acceptors; j++) {
+      if(socketpair(AF_UNIX, SOCK_DGRAM, 0, Accsp[j]) != 0) {
+         error("acc_init(): cannot open socketpair()");
+         Acceptors = j;  /* run the ones we have */
+         break;
+      }
+   }
+   for(j = 0; j < Acceptors; j++)
+      Apid[j] = acc_fork(j);
+   plog("Started %d acceptors", Acceptors);
+   return VEOK;
+}  /* end acc_init() */
+
+
+/* Take in the TX's, verdicts and requests from acceptor()'s, and
+ * restart those that died.  Called each server() loop.
+ */
+void acc_poll(void)
+{
+   static time_t filltime;
+   ACCRING *rp;
+   ACCMSG *mp;
+   NODE *hp;
+   word32 ip;
+   int j, status;
+
+   if(Acceptors && Ltime != filltime) {
+      filltime = Ltime;
+      pink_refill();  /* buckets acceptor()'s take from */
+   }
+   for(Nacclost = j = 0; j < Acceptors; j++) {
+      Nacclost += Accring[j].lost;
+      if(Apid[j] && waitpid(Apid[j], NULL, WNOHANG) > 0) Apid[j] = 0;
+      if(Apid[j] == 0 && Running) Apid[j] = acc_fork(j);
+      rp = &Accring[j];
+      while(rp->tail != rp->head) {
+         __sync_synchronize();  /* head before message */
+         mp = &rp->msg[rp->tail % ACCQLEN];
+         if(mp->kind == AQ_PINK) pinklist(mp->node.src_ip);
+         else if(mp->kind == AQ_EPINK) epinklist(mp->node.src_ip);
+         else if(mp->kind == AQ_CONNECT)
+            peer_take(mp->node.src_ip, PT_CONNECT);
+         else {
+            /* checked by acceptor() -- no reply, no session */
+            mp->node.sd = INVALID_SOCKET;  /* not ours */
+            status = load_shed(&mp->node) ? 0 : tx_recv(&mp->node);
+            if(status > 1) {
+               ip = mp->node.src_ip;
+               if(status > 2) epinklist(ip);
+               pinklist(ip);
+               Nbadlogs++;
+            }
+         }
+         __sync_synchronize();  /* done with message before tail */
+         rp->tail++;
+      }
+      for(hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++) {
+         if(hp->state != HS_IDLE) continue;
+         if(acc_recv(j, hp) != VEOK) break;
+         if(pinklisted(hp->src_ip)) {  /* connect charged by acceptor() */
+            closesocket(hp->sd);
+            continue;
+         }
+         hp->state = HS_READY;  /* server() steps it with gettx() */
+      }
+   }  /* end for j */
+}  /* end acc_poll() */
+
+
+/* Stop all acceptor()'s  -- in server() */
+void acc_stop(void)
+{
+   int j;
+
+   for(j = 0; j < Acceptors; j++) {
+      if(Apid[j] == 0) continue;
+      kill(Apid[j], SIGTERM);
+      waitpid(Apid[j], NULL, 0);
+      Apid[j] = 0;
+   }
+}  /* end acc_stop() */
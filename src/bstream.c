@@ -0,0 +1,142 @@
+/* bstream.c  Check a block while get_block2() receives it
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * get_block2() hands each frame of an OP_GETBLOCK to bs_update().  As
+ * each TXQENTRY comes in whole, it gets the checks of bval that need
+ * no ledger: addresses, fee, tx_id and its order, and the WOTS
+ * signature, while the rest of the block is still on the wire.  A bad
+ * TX ends the download there.  The block hash is kept running, and
+ * bs_final() writes it to bsig.dat for a block that passed -- or to
+ * Bsigfname, which pf_child() sets for each block.  bval then
+ * skips the WOTS checks of a block with that bt.bhash -- it still
+ * hashes the file, so it cannot be fooled by a block changed since.
+ *
+ * Ledger lookups stay in bval: the ledger FILE is shared with server()
+ * across fork().
+*/
+
+
+typedef struct {
+   SHA256_CTX ctx;      /* header and TX's so far */
+   byte buff[sizeof(TXQENTRY) + sizeof(BTRAILER)];  /* not yet hashed */
+   word32 blen;         /* bytes in buff[] */
+   word32 hdrlen;
+   word32 tnum;         /* TX's checked */
+   byte prev_tx_id[HASHLEN];
+   int status;          /* VEOK, VEBAD, or -1 to not check */
+} BSTREAM;
+
+char *Bsigfname = "bsig.dat";   /* written by bs_final() */
+
+
+/* Start on a new block if check is non-zero. */
+void bs_init(BSTREAM *bs, int check)
+{
+   memset(bs, 0, sizeof(BSTREAM));
+   if(!check) bs->status = -1;
+   sha256_init(&bs->ctx);
+}
+
+
+/* Check one TX of the block.  Returns VEOK or VEBAD. */
+int bs_tx(BSTREAM *bs, TXQENTRY *tx)
+{
+   static byte tx_id[HASHLEN], message[HASHLEN];
+   static byte pk2[TXSIGLEN], rnd2[32];
+
+   if(bs->tnum >= MAXBLTX) return VEBAD;
+   if(memcmp(tx->src_addr, tx->chg_addr, TXADDRLEN) == 0) return VEBAD;
+   if(!ismtx(tx) && memcmp(tx->src_addr, tx->dst_addr, TXADDRLEN) == 0)
+      return VEBAD;
+   if(cmp64(tx->tx_fee, Mfee) < 0) return VEBAD;
+   sha256(tx->src_addr, TXADDRLEN, tx_id);
+   if(memcmp(tx_id, tx->tx_id, HASHLEN) != 0) return VEBAD;
+   if(bs->tnum && memcmp(tx_id, bs->prev_tx_id, HASHLEN) <= 0)
+      return VEBAD;  /* unsorted or duplicate */
+   memcpy(bs->prev_tx_id, tx_id, HASHLEN);
+   /* check WOTS signature */
+   sha256(tx->src_addr, SIG_HASH_COUNT, message);
+   memcpy(rnd2, &tx->src_addr[TXSIGLEN+32], 32);  /* copy WOTS addr[] */
+   wots_pk_from_sig(pk2, tx->tx_sig, message, &tx->src_addr[TXSIGLEN],
+                    (word32 *) rnd2);
+   if(memcmp(pk2, tx->src_addr, TXSIGLEN) != 0) {
+      if(Trace) plog("bs_tx(): WOTS signature failed in TX %u", bs->tnum);
+      return VEBAD;
+   }
+   bs->tnum++;
+   return VEOK;
+}  /* end bs_tx() */
+
+
+/* Take the next len bytes of the block.
+ * Returns VEOK, or VEBAD if the block is bad.
+ */
+int bs_update(BSTREAM *bs, byte *data, int len)
+{
+   int n;
+
+   if(bs->status != VEOK) return bs->status == VEBAD ? VEBAD : VEOK;
+   while(len > 0) {
+      if(bs->hdrlen == 0) {  /* fill the header */
+         n = sizeof(BHEADER) - bs->blen;
+      } else {
+         /* A TX is whole and not the trailer once a trailer's worth
+          * of bytes follows it.
+          */
+         n = sizeof(bs->buff) - bs->blen;
+      }
+      if(n > len) n = len;
+      memcpy(bs->buff + bs->blen, data, n);
+      bs->blen += n;
+      data += n;
+      len -= n;
+      if(bs->hdrlen == 0) {
+         if(bs->blen >= 4 && get32(bs->buff) != sizeof(BHEADER)) {
+            bs->status = -1;  /* pseudo-block: leave it to bval */
+            return VEOK;
+         }
+         if(bs->blen < sizeof(BHEADER)) continue;
+         sha256_update(&bs->ctx, bs->buff, sizeof(BHEADER));
+         bs->hdrlen = sizeof(BHEADER);
+         bs->blen = 0;
+         continue;
+      }
+      if(bs->blen < sizeof(bs->buff)) continue;
+      if(bs_tx(bs, (TXQENTRY *) bs->buff) != VEOK) {
+         bs->status = VEBAD;
+         return VEBAD;
+      }
+      sha256_update(&bs->ctx, bs->buff, sizeof(TXQENTRY));
+      memmove(bs->buff, bs->buff + sizeof(TXQENTRY), sizeof(BTRAILER));
+      bs->blen = sizeof(BTRAILER);
+   }  /* end while */
+   return VEOK;
+}  /* end bs_update() */
+
+
+/* At the end of the block: write the block hash to Bsigfname if all
+ * of its TX's were checked, else remove Bsigfname.
+ * Returns VEOK if it was written, else VERROR.
+ */
+int bs_final(BSTREAM *bs)
+{
+   BTRAILER *bt;
+   byte bhash[HASHLEN];
+
+   unlink(Bsigfname);
+   if(bs->status != VEOK || bs->hdrlen == 0) return VERROR;
+   /* what is left must be just the trailer */
+   if(bs->blen != sizeof(BTRAILER)) return VERROR;
+   bt = (BTRAILER *) bs->buff;
+   if(get32(bt->tcount) != bs->tnum || bs->tnum == 0) return VERROR;
+   sha256_update(&bs->ctx, bs->buff, sizeof(BTRAILER) - HASHLEN);
+   sha256_final(&bs->ctx, bhash);
+   if(memcmp(bhash, bt->bhash, HASHLEN) != 0) return VERROR;
+   if(write_data(bhash, HASHLEN, Bsigfname) != VEOK) return VERROR;
+   if(Trace) plog("bs_final(): %u TX's checked", bs->tnum);
+   return VEOK;
+}  /* end bs_final() */
@@ -112,6 +112,8 @@ int main(int argc, char **argv)
    int count;
    static byte do_rename = 1;
    static byte pk2[WOTSSIGBYTES], message[32], rnd2[32];  /* for WOTS */
+   static byte bsig[HASHLEN];       /* from bs_final() in get_block2() */
+   int sigok;
    static char *haiku;
    static char haikufull[256];
    word32 now;
@@ -202,6 +204,14 @@ badread:
    if(memcmp(Cblockhash, bt.phash, HASHLEN) != 0)
       drop("previous hash mismatch");
 
+   /* Were the signatures checked as the block came in?
+    * The block hash is checked below either way.
+    */
+   sigok = read_data(bsig, HASHLEN, "bsig.dat") == HASHLEN
+           && memcmp(bsig, bt.bhash, HASHLEN) == 0;
+   unlink("bsig.dat");
+   if(Trace && sigok) plog("bval: signatures checked by get_block2()");
+
    /* check enforced delay, collect haiku from block */
    if(cmp64(bnum, v24trigger) > 0) {
       if(peach(&bt, get32(bt.difficulty), NULL, 1)){
@@ -283,12 +293,14 @@ badread:
       memcpy(prev_tx_id, tx_id, HASHLEN);
 
       /* check WTOS signature */
-      sha256(tx.src_addr, SIG_HASH_COUNT, message);
-      memcpy(rnd2, &tx.src_addr[TXSIGLEN+32], 32);  /* copy WOTS addr[] */
-      wots_pk_from_sig(pk2, tx.tx_sig, message, &tx.src_addr[TXSIGLEN],
-                       (word32 *) rnd2);
-      if(memcmp(pk2, tx.src_addr, TXSIGLEN) != 0)
-         baddrop("WOTS signature failed!");
+      if(!sigok) {
+         sha256(tx.src_addr, SIG_HASH_COUNT, message);
+         memcpy(rnd2, &tx.src_addr[TXSIGLEN+32], 32);  /* WOTS addr[] */
+         wots_pk_from_sig(pk2, tx.tx_sig, message, &tx.src_addr[TXSIGLEN],
+                          (word32 *) rnd2);
+         if(memcmp(pk2, tx.src_addr, TXSIGLEN) != 0)
+            baddrop("WOTS signature failed!");
+      }
 
       /* look up source address in ledger */
       if(le_find(tx.src_addr, &src_le, NULL, 0) == FALSE)
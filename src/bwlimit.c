@@ -0,0 +1,187 @@
+/* bwlimit.c  Token-bucket upload limits for file serving
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * Children that serve files with send_data() share Bwslot[], one slot
+ * per Nodes[] entry, in memory mapped by server() before any fork().
+ * Each child writes only its own slot and reads the others to count
+ * the transfers in progress, so the global rate (-B) and the per-peer
+ * rate are split evenly among the peers sending right now, and idle
+ * bandwidth goes to the active transfers without any locks.
+ * Each child paces its frames with a local token bucket, charged with
+ * the bytes each frame puts on the wire.
+*/
+
+
+typedef struct {
+   word32 ip;              /* peer being served, zero if idle */
+   word32 opcode;          /* OP_GETBLOCK, OP_GET_TFILE, OP_TF, ... */
+   word32 rate;            /* current limit in bytes/sec, zero = none */
+   time_t start;           /* transfer start time */
+   unsigned long bytes;    /* sent so far in this transfer */
+   unsigned long total;    /* sent by the child in all its transfers */
+} BWSLOT;
+
+BWSLOT *Bwslot;   /* MAXNODES slots shared with children */
+
+double Bwtokens, Bwlast;  /* token bucket of this child */
+
+
+/* Map Bwslot[] before server() forks any children.
+ * Returns VEOK, or VERROR if serving cannot be limited.
+ */
+int bw_init(void)
+{
+   Bwslot = mmap(NULL, MAXNODES * sizeof(BWSLOT), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(Bwslot == MAP_FAILED) {
+      Bwslot = NULL;
+      return error("bw_init(): cannot mmap() Bwslot[]");
+   }
+   return VEOK;
+}  /* end bw_init() */
+
+
+/* Return the shared slot of child NODE np, or NULL if none. */
+BWSLOT *bw_slot(NODE *np)
+{
+   if(Bwslot == NULL || np < Nodes || np >= &Nodes[MAXNODES]) return NULL;
+   return &Bwslot[np - Nodes];
+}
+
+
+double bw_now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Return the rate cap in bytes/sec for opcode, or zero. */
+word32 bw_opcap(int opcode)
+{
+   switch(opcode) {
+      case OP_GETBLOCK:   return Bwop[0];
+      case OP_GET_TFILE:  return Bwop[1];
+      case OP_TF:         return Bwop[2];
+   }
+   return 0;
+}
+
+
+/* Return the lowest of the opcode cap and the even shares of the
+ * global and per-peer rates for slot sp, or zero for no limit.
+ */
+word32 bw_rate(BWSLOT *sp)
+{
+   BWSLOT *bp;
+   word32 nall, npeer, rate, share;
+
+   nall = npeer = 0;
+   for(bp = Bwslot; bp < &Bwslot[MAXNODES]; bp++) {
+      if(bp->ip == 0) continue;
+      nall++;
+      if(bp->ip == sp->ip) npeer++;
+   }
+   if(nall == 0) nall = npeer = 1;
+   rate = bw_opcap(sp->opcode);
+   if(Bwrate) {
+      share = Bwrate / nall;
+      if(rate == 0 || share < rate) rate = share;
+   }
+   if(Bwpeer) {
+      share = Bwpeer / npeer;
+      if(rate == 0 || share < rate) rate = share;
+   }
+   if(rate && rate < TXBUFFLEN) rate = TXBUFFLEN;  /* a frame a second */
+   return rate;
+}  /* end bw_rate() */
+
+
+/* Claim the slot of np for a transfer  -- in child
+ * A child with a session claims it once per request, so total is
+ * left to add up until bw_reap().
+ */
+void bw_start(NODE *np)
+{
+   BWSLOT *sp;
+
+   sp = bw_slot(np);
+   if(sp == NULL) return;
+   sp->opcode = np->opcode;
+   sp->rate = 0;
+   sp->bytes = 0;
+   sp->start = time(NULL);
+   sp->ip = np->src_ip;  /* last: now counted by the others */
+   Bwtokens = TXBUFFLEN;  /* first frame goes at once */
+   Bwlast = bw_now();
+}
+
+
+/* Wait until the bucket holds len bytes, then take them  -- in child */
+void bw_wait(NODE *np, int len)
+{
+   BWSLOT *sp;
+   double now;
+
+   sp = bw_slot(np);
+   if(sp == NULL || sp->ip == 0) return;
+   sp->rate = bw_rate(sp);
+   if(sp->rate) {
+      now = bw_now();
+      Bwtokens += (now - Bwlast) * sp->rate;
+      if(Bwtokens > sp->rate) Bwtokens = sp->rate;  /* one second burst */
+      Bwlast = now;
+      Bwtokens -= len;
+      if(Bwtokens < 0) usleep((useconds_t) (-Bwtokens * 1e6 / sp->rate));
+   }
+   sp->bytes += len;
+   sp->total += len;
+}  /* end bw_wait() */
+
+
+/* Release the slot of np so others get its share  -- in child */
+void bw_done(NODE *np)
+{
+   BWSLOT *sp;
+
+   sp = bw_slot(np);
+   if(sp) sp->ip = 0;
+}
+
+
+/* Add up and clear the slot of a reaped child  -- in parent */
+void bw_reap(NODE *np)
+{
+   BWSLOT *sp;
+
+   sp = bw_slot(np);
+   if(sp == NULL) return;
+   Nkbsent += sp->total / 1024;
+   memset(sp, 0, sizeof(BWSLOT));
+}
+
+
+/* Show each transfer in progress for stats() */
+void bw_stats(void)
+{
+   BWSLOT *bp;
+   time_t dt;
+
+   if(Bwslot == NULL) return;
+   printf("   Served:          %u KB  limit %u KB/s  peer %u KB/s\n",
+          Nkbsent, Bwrate / 1024, Bwpeer / 1024);
+   for(bp = Bwslot; bp < &Bwslot[MAXNODES]; bp++) {
+      if(bp->ip == 0) continue;
+      dt = time(NULL) - bp->start;
+      if(dt < 1) dt = 1;
+      printf("   %-15s op %-2u %8lu KB %6lu KB/s (cap %u)\n",
+             ntoa((byte *) &bp->ip), bp->opcode, bp->bytes / 1024,
+             bp->bytes / 1024 / dt, bp->rate / 1024);
+   }
+}  /* end bw_stats() */
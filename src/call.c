@@ -7,6 +7,81 @@
 */
 
 
+/* Check the frame in np->tx.
+ * Returns VEOK if good, else VEBAD.
+ * Check id's if checkids is non-zero.
+ */
+int rxcheck(NODE *np, int checkids)
+{
+   TX *tx;
+
+   tx = &np->tx;
+   if(get16(tx->network) != TXNETWORK)
+      return VEBAD;
+   if(get16(tx->trailer) != TXEOT)
+      return VEBAD;
+   if(crc16(CRC_BUFF(tx), np->flen ? np->flen : CRC_COUNT)
+      != get16(tx->crc16))
+         return VEBAD;
+   if(checkids && (np->id1 != get16(tx->id1) || np->id2 != get16(tx->id2)))
+      return VEBAD;
+   return VEOK;
+}  /* end rxcheck() */
+
+
+/* Read what is there of the next frame into np->tx without blocking.
+ * A compact frame (see sendtxv()) is put back in place: its count goes
+ * to np->flen, the bytes to the front of np->tx, the crc16 and trailer
+ * to the end, and the rest is zeroed.
+ * Returns VEOK when a whole frame is in, -1 if not yet, VEBAD on a
+ * bad count, or VERROR if the connection was reset.
+ */
+int rx_step(NODE *np)
+{
+   int count, len;
+   byte *bp;
+   TX *tx;
+
+   tx = &np->tx;
+   for(;;) {
+      if(!varlen_rx(np)) {
+         np->flen = 0;
+         bp = TXBUFF(tx) + np->rlen;
+         len = TXBUFFLEN - np->rlen;
+      } else if(np->rlen < 2) {
+         bp = tx->crc16 + np->rlen;  /* count goes here for now */
+         len = 2 - np->rlen;
+      } else if(np->rlen < 2 + np->flen) {
+         bp = TXBUFF(tx) + np->rlen - 2;
+         len = 2 + np->flen - np->rlen;
+      } else {
+         bp = tx->crc16 + np->rlen - 2 - np->flen;  /* and trailer */
+         len = 2 + np->flen + 4 - np->rlen;
+      }
+      count = recv(np->sd, bp, len, 0);
+      if(count == 0) return VERROR;
+      if(count < 0) {
+         if(errno == EWOULDBLOCK || errno == EINTR) return -1;
+         return VERROR;
+      }
+      np->rlen += count;
+      if(count < len) return -1;
+      if(!varlen_rx(np)) break;
+      if(np->rlen == 2) {
+         np->flen = get16(tx->crc16);
+         if(np->flen < (TRANBUFF(tx) - TXBUFF(tx)) || np->flen > CRC_COUNT)
+            return VEBAD;
+         continue;  /* read the frame */
+      }
+      if(np->rlen < 2 + np->flen + 4) continue;  /* read crc and trailer */
+      memset(TXBUFF(tx) + np->flen, 0, CRC_COUNT - np->flen);
+      break;
+   }  /* end for */
+   np->rlen = 0;  /* for the next frame */
+   return VEOK;
+}  /* end rx_step() */
+
+
 /* Receive next packet from NODE *np
  * SOCKET np->sd is already set non-blocking.
  * Returns: VEOK (0) = good, else error code.
@@ -15,42 +90,101 @@
  */
 int rx2(NODE *np, int checkids, int seconds)
 {
-   int count, n;
+   int status;
    time_t timeout;
-   TX *tx;
 
-   tx = &np->tx;
    timeout = time(NULL) + seconds;
 
    if(Trace)
       plog("Entering rx() sd = %d  id1 = %x  id2 = %x",
            np->sd, np->id1, np->id2); /* debug */
 
-   for(n = 0; ; ) {
-      count = recv(np->sd, TXBUFF(tx) + n, TXBUFFLEN - n, 0);
-      if(count == 0) return VERROR;
-      if(count < 0) {
-         if(time(NULL) >= timeout) return VETIMEOUT;
-         msleep(1);
-         continue;
-      }
-      n += count;
-      if(n == TXBUFFLEN) break;
+   for(np->rlen = 0; ; ) {
+      status = rx_step(np);
+      if(status == VEOK) break;
+      if(status != -1) return status;
+      if(time(NULL) >= timeout) return VETIMEOUT;
+      msleep(1);
    }  /* end for */
 
    /* check tx and return error codes or count */
-   if(get16(tx->network) != TXNETWORK)
-      return VEBAD;
-   if(get16(tx->trailer) != TXEOT)
-      return VEBAD;
-   if(crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16))
-      return VEBAD;
-   if(checkids && (np->id1 != get16(tx->id1) || np->id2 != get16(tx->id2)))
-      return VEBAD;
-   return VEOK;  /* 0 success */
+   return rxcheck(np, checkids);  /* VEOK (0) on success */
 }  /* end rx2() */
 
 
+/* Return the Xcaps advertised in an OP_HELLO or OP_HELLO_ACK tx. */
+word32 get_xcaps(TX *tx)
+{
+   if((tx->version[1] & C_EXTCAP) == 0) return 0;
+   return get32(tx->blocknum);
+}
+
+
+/* Peers that sent OP_BUSY and when to call them again.  busy_init()
+ * maps them shared before the first fork(), so what a child hears
+ * holds for server() and every other child.  Any process may write
+ * a slot; a torn one only makes a peer wait a little more or less.
+ */
+typedef struct {
+   volatile word32 ip;
+   volatile time_t until;
+} BUSYPEER;
+
+BUSYPEER Busytab[BUSYLEN];
+BUSYPEER *Busy = Busytab;
+
+
+/* Map Busy[] shared, once.  Returns VEOK, or VERROR to keep it
+ * private to each process.
+ */
+int busy_init(void)
+{
+   BUSYPEER *bp;
+
+   if(Busy != Busytab) return VEOK;
+   bp = mmap(NULL, sizeof(Busytab), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(bp == MAP_FAILED) return error("busy_init(): cannot mmap() Busy[]");
+   memcpy(bp, Busytab, sizeof(Busytab));
+   Busy = bp;
+   return VEOK;
+}  /* end busy_init() */
+
+
+/* Note the retry-after time if np->tx is an OP_BUSY reply. */
+void busy_check(NODE *np)
+{
+   int j, k;
+
+   if(get16(np->tx.opcode) != OP_BUSY || get16(np->tx.len) < 2) return;
+   for(j = k = 0; j < BUSYLEN; j++) {
+      if(Busy[j].ip == np->src_ip) { k = j; break; }
+      if(Busy[j].until < Busy[k].until) k = j;  /* oldest */
+   }
+   Busy[k].until = time(NULL) + get16(TRANBUFF(&np->tx));
+   Busy[k].ip = np->src_ip;
+   if(Trace) plog("busy_check(): %s busy for %u seconds",
+                  ntoa((byte *) &np->src_ip), get16(TRANBUFF(&np->tx)));
+}
+
+
+/* Return non-zero if ip asked us to wait with OP_BUSY and its
+ * retry-after time has not passed.
+ */
+int busy_peer(word32 ip)
+{
+   int j;
+
+   for(j = 0; j < BUSYLEN; j++) {
+      if(Busy[j].ip == ip && time(NULL) < Busy[j].until) {
+         if(Trace) plog("busy_peer(): %s is busy", ntoa((byte *) &ip));
+         return 1;
+      }
+   }
+   return 0;
+}
+
+
 /* Call peer and complete Three-Way */
 int callserver(NODE *np, word32 ip)
 {
@@ -58,6 +192,10 @@ int callserver(NODE *np, word32 ip)
 
    if(Trace) plog("callserver(): Trying %s...", ntoa((byte *) &ip));
 
+   if(busy_peer(ip)) {
+      np->sd = INVALID_SOCKET;
+      return VERROR;
+   }
    memset(np, 0, sizeof(NODE));   /* clear structure */
    np->sd = connectip(ip);  /* returns non-blocked sd */
    if(np->sd == INVALID_SOCKET) return VERROR;
@@ -75,6 +213,8 @@ bad:
    }
    np->id2 = get16(np->tx.id2);
    np->opcode = get16(np->tx.opcode);
+   np->caps = np->tx.version[1];
+   np->xcaps = get_xcaps(&np->tx);
    if(np->opcode != OP_HELLO_ACK || get16(np->tx.id1) != np->id1) {
       if(Trace) plog("   *** HELLO_ACK is wrong: %d", np->opcode);
       pinklist(ip);   /* protocol violator! */
@@ -85,18 +225,123 @@ bad:
 }  /* end callserver() */
 
 
+/* Keep-alive sessions: if both ends have X_SESSION, server() keeps
+ * the connection after a SESS_PARENT request and waits for the next
+ * one, and a child that serves a SESS_FILE request keeps serving file
+ * requests.  Clients park idle connections with sess_put() and take
+ * them back with sess_get().  Each process has its own pool, and
+ * slots inherited across fork() are dropped by pid.
+ */
+
+NODE Sessions[SESSLEN];  /* .pid is owner, .state is class */
+
+
+/* Return the session class of opcode, or 0 if the session ends. */
+int sess_class(int opcode)
+{
+   switch(opcode) {
+      case OP_TX:
+      case OP_GETIPL:
+      case OP_BALANCE:
+      case OP_HASH:
+      case OP_RESOLVE:
+      case OP_IDENTIFY:
+      case OP_INV:
+         return SESS_PARENT;
+      case OP_GETBLOCK:
+      case OP_GET_TFILE:
+      case OP_TF:
+         return SESS_FILE;
+   }
+   return 0;
+}  /* end sess_class() */
+
+
+/* Get a connection to ip for opcode: take a parked session of the
+ * same class if it is still open, else callserver().
+ * Returns VEOK or VERROR like callserver().
+ */
+int sess_get(NODE *np, word32 ip, int opcode)
+{
+   NODE *sp;
+   byte b;
+   pid_t pid;
+   time_t now;
+
+   pid = getpid();
+   now = time(NULL);
+   for(sp = Sessions; sp < &Sessions[SESSLEN]; sp++) {
+      if(sp->pid == 0) continue;
+      if(sp->pid != pid || now >= sp->deadline) {
+         closesocket(sp->sd);  /* stale, or our copy of a parent's */
+         sp->pid = 0;
+         continue;
+      }
+      if(sp->src_ip != ip || sp->state != sess_class(opcode)) continue;
+      sp->pid = 0;
+      /* An open idle session has nothing to read. */
+      if(recv(sp->sd, &b, 1, MSG_PEEK) != -1 || errno != EWOULDBLOCK) {
+         closesocket(sp->sd);
+         continue;
+      }
+      if(Trace) plog("sess_get(): reuse %s", ntoa((byte *) &ip));
+      memcpy(np, sp, sizeof(NODE));
+      np->pid = 0;
+      np->state = HS_IDLE;
+      return VEOK;
+   }
+   return callserver(np, ip);
+}  /* end sess_get() */
+
+
+/* Park the connection of np for reuse after a request of opcode,
+ * or close it if the session ends.
+ * Sets np->sd to INVALID_SOCKET on return.
+ */
+void sess_put(NODE *np, int opcode)
+{
+   NODE *sp, *oldest;
+   pid_t pid;
+   int class;
+
+   if(np->sd == INVALID_SOCKET) return;
+   class = sess_class(opcode);
+   if(class == 0 || (np->xcaps & Xcaps & X_SESSION) == 0) {
+      closesocket(np->sd);
+      np->sd = INVALID_SOCKET;
+      return;
+   }
+   /* find a free slot, or drop the oldest session */
+   pid = getpid();
+   oldest = Sessions;
+   for(sp = Sessions; sp < &Sessions[SESSLEN]; sp++) {
+      if(sp->pid == 0) break;
+      if(sp->pid != pid) { closesocket(sp->sd); break; }
+      if(sp->deadline < oldest->deadline) oldest = sp;
+   }
+   if(sp >= &Sessions[SESSLEN]) {
+      sp = oldest;
+      closesocket(sp->sd);
+   }
+   memcpy(sp, np, sizeof(NODE));
+   sp->pid = pid;
+   sp->state = class;
+   sp->deadline = time(NULL) + SESSIDLE / 2;  /* well before the server */
+   np->sd = INVALID_SOCKET;
+}  /* end sess_put() */
+
+
 /* Used for opcode = OP_GETHAL or OP_GETIPL
- * Close socket and sets np->sd to INVALID_SOCKET on return.
+ * Parks or closes socket and sets np->sd to INVALID_SOCKET on return.
  */
 int get_tx2(NODE *np, word32 ip, word16 opcode)
 {
-   if(callserver(np, ip) != VEOK)
+   if(sess_get(np, ip, opcode) != VEOK)
       return VERROR;
 
-   send_op(np, opcode);
-   if(rx2(np, 1, 10) == VEOK) {
-      closesocket(np->sd);
-      np->sd = INVALID_SOCKET;
+   if(send_op(np, opcode) == VEOK && rx2(np, 1, 10) == VEOK) {
+      busy_check(np);
+      sess_put(np, opcode);
       return VEOK;
    }
    closesocket(np->sd);
@@ -108,7 +353,13 @@ int get_tx2(NODE *np, word32 ip, word16 opcode)
 /* Get a block or other file from peer, ip.
  * opcode is OP_GETBLOCK or OP_GET_TFILE.
  * bnum can be NULL for OP_GET_FILE.
- * Returns VEOK (0) on good download, else VERROR (1).
+ * A block is checked by bs_update() as it comes in.
+ * tfile.dat and neo-genesis blocks are received into fname.rsm, which
+ * is kept if the download fails, and the next call continues from its
+ * end with X_RESUME -- from any peer.  Only whole frames are written,
+ * so the size of fname.rsm marks the progress.
+ * Returns VEOK (0) on good download, VETIMEOUT if ip could not be
+ * called or sent OP_BUSY, else VERROR (1).
  */
 int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
 {
@@ -117,23 +368,62 @@ int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
    word16 len;
    int n;
    int ecode = 666;
+   char rsmname[FILENAME_MAX];
+   char *recname;
+   long offset;
+   int resume, refused;
+#ifndef EXCLUDE_BSTREAM
+   static BSTREAM bs;
+#endif
 
    if(Trace) plog("Entering get_block2() Recfile is '%s'", fname);
    show("getblock");
 
-   fp = fopen(fname, "wb");
+   resume = opcode == OP_GET_TFILE
+            || (opcode == OP_GETBLOCK && bnum && bnum[0] == 0);
+   recname = fname;
+   offset = 0;
+   if(resume) {
+      sprintf(rsmname, "%s.rsm", fname);
+      recname = rsmname;
+      fp = fopen(recname, "r+b");
+      if(fp && fseek(fp, 0, SEEK_END) == 0) offset = ftell(fp);
+      if(offset < 0) offset = 0;
+      offset -= offset % TRANLEN;  /* whole frames only */
+   } else fp = NULL;
+   if(fp == NULL) fp = fopen(recname, "w+b");
    if(fp == NULL)
-      return error("cannot open %s", fname);
+      return error("cannot open %s", recname);
 
-   if(callserver(&node, ip) != VEOK)
+   refused = 0;
+   if(sess_get(&node, ip, opcode) != VEOK) {
+      refused = 1;  /* down, busy, or over its connect rate */
+      goto bad;
+   }
+   if((node.xcaps & Xcaps & X_RESUME) == 0) offset = 0;
+   if(fseek(fp, offset, SEEK_SET) != 0
+      || ftruncate(fileno(fp), offset) != 0) {
+      error("get_block2(): cannot seek %s", recname);
       goto bad;
-   
+   }
+   if(offset && Trace)
+      plog("get_block2(): resume %s at %ld", recname, offset);
+
    /* set request block number */
    if(bnum) put64(node.tx.blocknum, bnum);
+   put32(node.tx.send_total, offset);  /* X_RESUME offset */
+   put32(node.tx.send_total + 4, (offset >> 16) >> 16);
    if(send_op(&node, opcode) != VEOK) goto bad;
+#ifndef EXCLUDE_BSTREAM
+   bs_init(&bs, opcode == OP_GETBLOCK && offset == 0);
+#endif
    for(;;) {
       if((ecode = rx2(&node, 1, 10)) != VEOK) goto bad;
-      if(get16(node.tx.opcode) != OP_SEND_BL) goto bad; 
+      if(get16(node.tx.opcode) != OP_SEND_BL) {
+         busy_check(&node);
+         if(get16(node.tx.opcode) == OP_BUSY) refused = 1;
+         goto bad;
+      }
       len = get16(node.tx.len);
       if(len > TRANLEN) goto bad;
       if(len) {
@@ -142,24 +432,40 @@ int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
             error("get_block2() I/O error");
             goto bad;
          }
+#ifndef EXCLUDE_BSTREAM
+         if(bs_update(&bs, TRANBUFF(&node.tx), len) != VEOK) {
+            ecode = VEBAD;
+            resume = 0;
+            goto bad;
+         }
+#endif
       }
       /* check EOF */
       if(len < 1 || n < TRANLEN) {
          fclose(fp);
-         closesocket(node.sd);
-         node.sd = INVALID_SOCKET;
+         if(resume && rename(recname, fname) != 0) {
+            error("get_block2(): cannot rename %s", recname);
+            unlink(recname);
+            goto out;
+         }
+#ifndef EXCLUDE_BSTREAM
+         if(opcode == OP_GETBLOCK) bs_final(&bs);
+#endif
+         sess_put(&node, opcode);
          if(Trace) plog("get_block2(): EOF");
          return VEOK;
       } /* end if EOF */
    }  /* end for */
 bad:
+   if(ftell(fp) <= 0) resume = 0;
    fclose(fp);
-   unlink(fname);  /* delete partial downloads */
+   if(!resume) unlink(recname);  /* delete partial downloads */
+out:
    if(node.sd != INVALID_SOCKET)
       closesocket(node.sd);
    node.sd = INVALID_SOCKET;
    if(Trace)
       plog("get_block2(): fail (%d) len = %d opcode = %d",
            ecode, get16(node.tx.len), get16(node.tx.opcode));
-   return VERROR;
+   return refused ? VETIMEOUT : VERROR;
 }  /* end get_block2() */
@@ -0,0 +1,242 @@
+/* catchup.c  Catch up on blocks without stopping server()
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * When a peer is more than one block ahead, contention() calls
+ * catchup() to start the cu_fetch() child.  It takes up to CUTF
+ * trailers after Cblocknum from that peer with OP_TF, keeps those that
+ * chain on from Cblockhash, and asks the peers of Rplist[] at once for
+ * the hash of the last with OP_HASH.  The ones that agree fetch the
+ * blocks with it through pf_step(), PFLEN at a time over one session
+ * to each peer, no more than PFAHEAD ahead of Cblocknum, and each is
+ * kept as cu<bnum>.dat only if it has its trailer.  Then the next
+ * CUTF trailers, and so on until the peer has no more.  Progress is
+ * kept in Custate, mapped shared by cu_init().
+ *
+ * server() calls cu_apply() once each loop.  If the next block is in,
+ * it gets bval2() and update() right there, one block per loop, so
+ * handshakes, TX's and block requests are served in between.  The
+ * first block failing update() is contention, as it was when catchup()
+ * ran in line.  cu_stop() ends it all early, or when the child is done.
+*/
+
+
+typedef struct {
+   volatile word32 fetched;   /* blocks downloaded -- by cu_fetch() */
+   volatile word32 applied;   /* blocks updated -- by server() */
+   volatile int done;         /* 1 cu_fetch() has finished, 2 died */
+   word32 peer;
+   byte first[8];             /* first block to fetch */
+   byte cblock[8];            /* Cblocknum of server() */
+} CUSTATE;
+
+CUSTATE *Custate;   /* shared with cu_fetch() */
+TX Cutx;            /* OP_FOUND proof for checkproof() */
+byte Cuproof;       /* Cutx is set */
+
+
+/* Map Custate before server() forks any children.
+ * Returns VEOK or VERROR.
+ */
+int cu_init(void)
+{
+   Custate = mmap(NULL, sizeof(CUSTATE), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(Custate == MAP_FAILED) {
+      Custate = NULL;
+      return error("cu_init(): cannot mmap() Custate");
+   }
+   return VEOK;
+}  /* end cu_init() */
+
+
+/* Set fname to the catchup file of bnum. */
+char *cu_fname(char *fname, byte *bnum, char *ext)
+{
+   sprintf(fname, "cu%s.%s", bnum2hex(bnum), ext);
+   return fname;
+}
+
+
+/* Fetch up to CUTF trailers from first on from Custate->peer into
+ * tf[], as far as they chain on from phash.  Returns the count.
+ */
+int cu_trailers(BTRAILER *tf, byte *first, byte *phash)
+{
+   byte req[8], bnum[8];
+   int j, n;
+
+   if(get32(first + 4)) return 0;
+   put32(req, get32(first));  /* OP_TF first and count */
+   put32(req + 4, CUTF);
+   if(get_block2(Custate->peer, req, "cutf.tmp", OP_TF) != VEOK) return 0;
+   n = read_data(tf, CUTF * sizeof(BTRAILER), "cutf.tmp") / sizeof(BTRAILER);
+   unlink("cutf.tmp");
+   put64(bnum, first);
+   for(j = 0; j < n; j++) {
+      if(cmp64(tf[j].bnum, bnum) != 0
+         || memcmp(tf[j].phash, phash, HASHLEN) != 0) {
+         if(Trace) plog("cu_trailers(): 0x%s does not follow",
+                        bnum2hex(bnum));
+         break;
+      }
+      phash = tf[j].bhash;
+      add64(bnum, One, bnum);
+   }
+   return j;
+}  /* end cu_trailers() */
+
+
+/* Fill ip[] with Custate->peer and the peers of Rplist[] whose hash of
+ * block bnum is bhash, all asked at once.  Returns the count.
+ */
+int cu_peers(word32 *ip, byte *bnum, byte *bhash)
+{
+   pid_t pid[RPLISTLEN];
+   byte hash[HASHLEN];
+   int j, n, status;
+
+   for(j = 0; j < RPLISTLEN; j++) {
+      pid[j] = 0;
+      if(Rplist[j] == 0 || Rplist[j] == Custate->peer) continue;
+      pid[j] = fork();
+      if(pid[j] == 0) {
+         exit(get_hash(Rplist[j], bnum, hash) != VEOK
+              || memcmp(hash, bhash, HASHLEN) != 0);
+      }
+      if(pid[j] < 0) pid[j] = 0;
+   }
+   ip[0] = Custate->peer;
+   for(n = 1, j = 0; j < RPLISTLEN; j++) {
+      if(pid[j] == 0) continue;
+      if(waitpid(pid[j], &status, 0) == pid[j] && status == 0
+         && n < PFPEERS) ip[n++] = Rplist[j];
+   }
+   return n;
+}  /* end cu_peers() */
+
+
+/* Download blocks into cu<bnum>.dat  -- in child
+ * Does not return.
+ */
+void cu_fetch(void)
+{
+   static BTRAILER tf[CUTF];
+   static PREFETCH pf;
+   word32 ip[PFPEERS];
+   byte first[8], last[8], phash[HASHLEN];
+   int n, npeer, count;
+
+   show("catchup");
+   put64(first, Custate->first);
+   memcpy(phash, Cblockhash, HASHLEN);
+   while(Running) {
+      n = cu_trailers(tf, first, phash);
+      if(n < 1) break;  /* no more */
+      put64(last, tf[n - 1].bnum);
+      npeer = cu_peers(ip, last, tf[n - 1].bhash);
+      if(Trace) plog("cu_fetch(): 0x%s from %d peers",
+                     bnum2hex(last), npeer);
+      pf_init(&pf, tf, first, last, ip, npeer, "cu");
+      while(Running && !pf_done(&pf)) {
+         count = pf_step(&pf, Custate->cblock);
+         if(count < 0) break;
+         __sync_synchronize();  /* files before count */
+         Custate->fetched += count;
+         if(count == 0) msleep(50);
+      }
+      pf_stop(&pf);
+      if(!pf_done(&pf)) break;
+      add64(last, One, first);
+      memcpy(phash, tf[n - 1].bhash, HASHLEN);
+   }  /* end while */
+   Custate->done = 1;
+   exit(0);
+}  /* end cu_fetch() */
+
+
+/* Start catching up from ip, unless already on it.  If tx is not NULL,
+ * it is the OP_FOUND proof of ip for contention.
+ * Returns VEOK or VERROR.
+ */
+int catchup(word32 ip, TX *tx)
+{
+   if(Cupid || Custate == NULL) return VEOK;
+   if(Trace) plog("catchup(%s)", ntoa((byte *) &ip));
+   memset(Custate, 0, sizeof(CUSTATE));
+   Custate->peer = ip;
+   add64(Cblocknum, One, Custate->first);
+   put64(Custate->cblock, Cblocknum);
+   Cuproof = tx != NULL;
+   if(tx) memcpy(&Cutx, tx, sizeof(TX));
+   Cupid = fork();
+   if(Cupid == 0) cu_fetch();
+   if(Cupid == -1) {
+      Cupid = 0;
+      return error("catchup(): cannot fork()");
+   }
+   return VEOK;
+}  /* end catchup() */
+
+
+/* Cancel catchup and remove its files. */
+void cu_stop(void)
+{
+   if(Cupid == 0) return;
+   if(Custate->done != 2) {  /* not reaped yet */
+      kill(Cupid, SIGTERM);
+      waitpid(Cupid, NULL, 0);
+   }
+   Cupid = 0;
+   system("rm -f cu*.dat cu*.sig cu*.tmp");
+   if(Trace) plog("cu_stop(): %u blocks of %u applied",
+                  Custate->applied, Custate->fetched);
+   if(Custate->applied) Mpsynctime = time(NULL);  /* refill mempool */
+}  /* end cu_stop() */
+
+
+/* Apply the next block of catchup, if in  -- in server() */
+void cu_apply(void)
+{
+   byte bnum[8];
+   char fname[64], sname[64];
+   int status, done;
+
+   if(Cupid == 0) return;
+   put64(Custate->cblock, Cblocknum);
+   unlink(cu_fname(fname, Cblocknum, "dat"));  /* came with OP_FOUND */
+   add64(Cblocknum, One, bnum);
+   if(bnum[0] == 0) add64(bnum, One, bnum);  /* NG from update() */
+   cu_fname(fname, bnum, "dat");
+   if(!Custate->done && waitpid(Cupid, NULL, WNOHANG) == Cupid)
+      Custate->done = 2;  /* died without saying -- reaped here */
+   /* read done before the file, which the child renames first */
+   done = Custate->done;
+   __sync_synchronize();
+   if(!exists(fname)) {
+      if(done) cu_stop();  /* all there was */
+      return;
+   }
+   if(Blockfound) return;  /* let OP_FOUND finish first */
+   status = bval2(fname, bnum, Difficulty);
+   if(status != VEOK) {
+      if(status == VEBAD) epinklist(Custate->peer);
+      cu_stop();
+      return;
+   }
+   rename(cu_fname(sname, bnum, "sig"), "bsig.dat");
+   if(update(fname, 0) != VEOK) {
+      if(Custate->applied == 0 && Cuproof && checkproof(&Cutx) != VEOK) {
+         write_data(&Custate->peer, 4, "rplist.lst");
+         cu_stop();
+         restart("contend");  /* Contention - RESTART */
+      }
+      cu_stop();
+      return;
+   }
+   unlink(fname);
+   Custate->applied++;
+}  /* end cu_apply() */
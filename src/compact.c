@@ -0,0 +1,324 @@
+/* compact.c  Compact block relay
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * If both ends have X_COMPACT, the child that fetches a block after
+ * OP_FOUND asks for it with OP_GET_CMPCT first.  The reply, sent as
+ * OP_SEND_BL frames, is
+ *
+ *    BHEADER  BTRAILER  tx_id[tcount][HASHLEN]
+ *    nfill[4]  nfill * { index[4]  TXQENTRY }
+ *
+ * The TX's filled in are those the sender never saw through gettx()
+ * (not in Txcache[]), so its peers likely lack them too -- at most
+ * CMPFILL of them.  cmp_build() rebuilds the block from the mempool,
+ * asks for the rest by index with OP_GET_BLTX on the same connection,
+ * and then runs the bytes through bs_update() like get_block2().  If
+ * the block hash does not come out right, say our mempool holds
+ * another TX from the same src_addr, the caller falls back to
+ * get_block2().
+*/
+
+
+#define CMPIDMAX  (TRANLEN / 4)   /* indices per OP_GET_BLTX */
+
+typedef struct {
+   byte *data;          /* block file, or NULL */
+   long size;
+   word32 tcount;
+   int mapped;          /* data is mmap()'d */
+} CMPBLOCK;
+
+
+/* Load block bnum for send_compact() from Hotblock[] or Bcdir.
+ * Returns VEOK, or VERROR if there is no good block.
+ */
+int cmp_load(CMPBLOCK *cp, byte *bnum)
+{
+   HOTBLOCK *hp;
+   BTRAILER *bt;
+   struct stat st;
+   char fname[128];
+   int fd;
+
+   memset(cp, 0, sizeof(CMPBLOCK));
+   hp = hb_find(bnum);
+   if(hp) {
+      cp->data = hp->data;
+      cp->size = hp->size;
+   } else {
+      sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(bnum));
+      fd = open(fname, O_RDONLY);
+      if(fd == -1) return VERROR;
+      if(fstat(fd, &st) == 0 && st.st_size > 0) {
+         cp->data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+         if(cp->data == MAP_FAILED) cp->data = NULL;
+         else cp->mapped = 1;
+         cp->size = st.st_size;
+      }
+      close(fd);
+      if(cp->data == NULL) return VERROR;
+   }
+   /* only normal blocks */
+   if(cp->size < (long) (sizeof(BHEADER) + sizeof(BTRAILER))
+      || get32(cp->data) != sizeof(BHEADER)) return VERROR;
+   bt = (BTRAILER *) (cp->data + cp->size - sizeof(BTRAILER));
+   cp->tcount = get32(bt->tcount);
+   if(cp->tcount > MAXBLTX || cp->size != (long) (sizeof(BHEADER)
+      + cp->tcount * sizeof(TXQENTRY) + sizeof(BTRAILER))) return VERROR;
+   return VEOK;
+}  /* end cmp_load() */
+
+
+/* Send the compact form of block cp to np. */
+int cmp_send(NODE *np, CMPBLOCK *cp)
+{
+   TXQENTRY *tx;
+   TXCENTRY *tc;
+   byte *buff, *bp, *nfp;
+   word32 j, nfill;
+   int status;
+
+   buff = malloc(sizeof(BHEADER) + sizeof(BTRAILER) + cp->tcount * HASHLEN
+                 + 4 + CMPFILL * (4 + sizeof(TXQENTRY)));
+   if(buff == NULL) return error("cmp_send(): out of memory");
+   bp = buff;
+   memcpy(bp, cp->data, sizeof(BHEADER));
+   bp += sizeof(BHEADER);
+   memcpy(bp, cp->data + cp->size - sizeof(BTRAILER), sizeof(BTRAILER));
+   bp += sizeof(BTRAILER);
+   tx = (TXQENTRY *) (cp->data + sizeof(BHEADER));
+   for(j = 0; j < cp->tcount; j++, bp += HASHLEN)
+      memcpy(bp, tx[j].tx_id, HASHLEN);
+   nfp = bp;
+   bp += 4;
+   for(j = nfill = 0; j < cp->tcount && nfill < CMPFILL; j++) {
+      tc = txcache_slot(tx[j].tx_id);
+      if(tc->status == TXC_ACCEPT
+         && memcmp(tc->tx_id, tx[j].tx_id, HASHLEN) == 0) continue;
+      put32(bp, j);
+      memcpy(bp + 4, &tx[j], sizeof(TXQENTRY));
+      bp += 4 + sizeof(TXQENTRY);
+      nfill++;
+   }
+   put32(nfp, nfill);
+   if(Trace) plog("cmp_send(): %u TX's, %u filled in", cp->tcount, nfill);
+   status = send_map(np, buff, bp - buff, 0, -1);
+   free(buff);
+   return status;
+}  /* end cmp_send() */
+
+
+/* Send the TX's of block cp at the indices in np->tx. */
+int cmp_sendtx(NODE *np, CMPBLOCK *cp)
+{
+   TXQENTRY *tx;
+   byte *buff, *bp, *ip;
+   word32 j, count, index;
+   int status;
+
+   count = get16(np->tx.len) / 4;
+   if(count == 0 || count > CMPIDMAX) return VERROR;
+   buff = malloc(count * sizeof(TXQENTRY));
+   if(buff == NULL) return error("cmp_sendtx(): out of memory");
+   tx = (TXQENTRY *) (cp->data + sizeof(BHEADER));
+   ip = TRANBUFF(&np->tx);
+   for(bp = buff, j = 0; j < count; j++, ip += 4) {
+      index = get32(ip);
+      if(index >= cp->tcount) continue;
+      memcpy(bp, &tx[index], sizeof(TXQENTRY));
+      bp += sizeof(TXQENTRY);
+   }
+   status = send_map(np, buff, bp - buff, 0, -1);
+   free(buff);
+   return status;
+}  /* end cmp_sendtx() */
+
+
+/* Answer OP_GET_CMPCT, and the OP_GET_BLTX requests that follow
+ * on np->sd until another request or timeout.
+ * Called from execute() in child.
+ * Returns VEOK, or VERROR on errors.
+ */
+int send_compact(NODE *np)
+{
+   CMPBLOCK cb;
+   int status;
+
+   show("sendcmp");
+   if(cmp_load(&cb, np->tx.blocknum) != VEOK) {
+      sendnack(np);
+      status = VERROR;
+      goto out;
+   }
+   for(;;) {
+      if(np->opcode == OP_GET_CMPCT) status = cmp_send(np, &cb);
+      else status = cmp_sendtx(np, &cb);  /* OP_GET_BLTX */
+      if(status != VEOK || !Running) break;
+      nonblock(np->sd);  /* send_map() set blocking */
+      if(rx2(np, 1, 10) != VEOK) break;
+      np->opcode = get16(np->tx.opcode);
+      if(np->opcode != OP_GET_BLTX) break;
+   }
+out:
+   if(cb.mapped) munmap(cb.data, cb.size);
+   return status;
+}  /* end send_compact() */
+
+
+/* Fetch the TX's of block file fp marked 0 in have[] with
+ * OP_GET_BLTX on np, and write them in place.
+ * Returns VEOK, or VERROR if any is missing.
+ */
+int cmp_fetch(NODE *np, FILE *fp, byte *ids, byte *have, word32 tcount)
+{
+   static TXQENTRY txq;
+   word32 j, k, count, index[CMPIDMAX];
+   FILE *fq;
+   int status;
+
+   for(j = 0; j < tcount; ) {
+      for(count = 0; j < tcount && count < CMPIDMAX; j++) {
+         if(have[j]) continue;
+         index[count] = j;
+         put32(TRANBUFF(&np->tx) + count * 4, j);
+         count++;
+      }
+      if(count == 0) break;
+      if(Trace) plog("cmp_fetch(): %u TX's", count);
+      put16(np->tx.len, count * 4);
+      if(send_op(np, OP_GET_BLTX) != VEOK
+         || get_block3(np, "cmptx.tmp") != 0) return VERROR;
+      fq = fopen("cmptx.tmp", "rb");
+      if(fq == NULL) return VERROR;
+      for(k = 0, status = VEOK; k < count; k++) {
+         if(fread(&txq, 1, sizeof(TXQENTRY), fq) != sizeof(TXQENTRY)
+            || memcmp(txq.tx_id, &ids[index[k] * HASHLEN], HASHLEN) != 0
+            || fseek(fp, sizeof(BHEADER) + index[k] * sizeof(TXQENTRY),
+                     SEEK_SET) != 0
+            || fwrite(&txq, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY)) {
+            status = VERROR;
+            break;
+         }
+         have[index[k]] = 1;
+      }
+      fclose(fq);
+      unlink("cmptx.tmp");
+      if(status != VEOK) return VERROR;
+   }  /* end for j */
+   return VEOK;
+}  /* end cmp_fetch() */
+
+
+/* Rebuild block fname from compact block file cname, our mempool, and
+ * OP_GET_BLTX requests on np, then check it with bs_update().
+ * Returns VEOK, or VERROR if the block could not be rebuilt.
+ */
+int cmp_build(NODE *np, char *cname, char *fname)
+{
+   static BHEADER bh;
+   static BTRAILER bt;
+   static TXQENTRY txq;
+   static BSTREAM bs;
+   FILE *fc, *fp, *fq[2];
+   MPIDX *idx, *ip;
+   byte *ids, *have, buff[4];
+   word32 j, n, tcount, nfill, index, nmp;
+   int status;
+
+   fc = fopen(cname, "rb");
+   if(fc == NULL) return VERROR;
+   fp = NULL;
+   idx = NULL;
+   fq[0] = fq[1] = NULL;
+   ids = have = NULL;
+   status = VERROR;
+   if(fread(&bh, 1, sizeof(BHEADER), fc) != sizeof(BHEADER)
+      || get32(bh.hdrlen) != sizeof(BHEADER)
+      || fread(&bt, 1, sizeof(BTRAILER), fc) != sizeof(BTRAILER)) goto out;
+   tcount = get32(bt.tcount);
+   if(tcount == 0 || tcount > MAXBLTX) goto out;
+   ids = malloc(tcount * HASHLEN);
+   have = calloc(tcount, 1);
+   fp = fopen(fname, "w+b");
+   if(ids == NULL || have == NULL || fp == NULL) goto out;
+   if(fread(ids, HASHLEN, tcount, fc) != tcount
+      || fread(buff, 1, 4, fc) != 4) goto out;
+   fwrite(&bh, 1, sizeof(BHEADER), fp);
+   /* the TX's that came with it */
+   for(nfill = get32(buff); nfill; nfill--) {
+      if(fread(buff, 1, 4, fc) != 4
+         || fread(&txq, 1, sizeof(TXQENTRY), fc) != sizeof(TXQENTRY))
+         goto out;
+      index = get32(buff);
+      if(index >= tcount
+         || memcmp(txq.tx_id, &ids[index * HASHLEN], HASHLEN) != 0)
+         goto out;
+      fseek(fp, sizeof(BHEADER) + index * sizeof(TXQENTRY), SEEK_SET);
+      fwrite(&txq, 1, sizeof(TXQENTRY), fp);
+      have[index] = 1;
+   }
+   /* the TX's in our mempool */
+   idx = mp_index(&nmp, fq);
+   for(j = n = 0; j < tcount && nmp; j++) {
+      if(have[j]) continue;
+      ip = bsearch(&ids[j * HASHLEN], idx, nmp, sizeof(MPIDX), mpid_cmp);
+      if(ip == NULL) continue;
+      if(fseek(fq[ip->q], (long) ip->rec * sizeof(TXQENTRY), SEEK_SET)
+         || fread(&txq, 1, sizeof(TXQENTRY), fq[ip->q]) != sizeof(TXQENTRY)
+         || memcmp(txq.tx_id, &ids[j * HASHLEN], HASHLEN) != 0) continue;
+      fseek(fp, sizeof(BHEADER) + j * sizeof(TXQENTRY), SEEK_SET);
+      fwrite(&txq, 1, sizeof(TXQENTRY), fp);
+      have[j] = 1;
+      n++;
+   }
+   if(Trace) plog("cmp_build(): %u of %u TX's from mempool", n, tcount);
+   /* and the rest from the peer */
+   if(cmp_fetch(np, fp, ids, have, tcount) != VEOK) goto out;
+   fseek(fp, sizeof(BHEADER) + tcount * sizeof(TXQENTRY), SEEK_SET);
+   fwrite(&bt, 1, sizeof(BTRAILER), fp);
+   if(fflush(fp) != 0 || ferror(fp)) goto out;
+   /* check the block as get_block2() does */
+   rewind(fp);
+   bs_init(&bs, 1);
+   while((n = fread(&txq, 1, sizeof(TXQENTRY), fp)) > 0)
+      if(bs_update(&bs, (byte *) &txq, n) != VEOK) goto out;
+   if(bs_final(&bs) == VEOK) status = VEOK;
+out:
+   if(fp) fclose(fp);
+   if(status != VEOK) unlink(fname);
+   fclose(fc);
+   if(fq[0]) fclose(fq[0]);
+   if(fq[1]) fclose(fq[1]);
+   if(idx) free(idx);
+   if(ids) free(ids);
+   if(have) free(have);
+   return status;
+}  /* end cmp_build() */
+
+
+/* Get block bnum from ip as a compact block into fname.
+ * Returns VEOK, or VERROR to fall back to get_block2().
+ */
+int get_compact(word32 ip, byte *bnum, char *fname)
+{
+   NODE node;
+   int status;
+
+   show("getcmp");
+   if(callserver(&node, ip) != VEOK) return VERROR;
+   status = VERROR;
+   if(node.xcaps & Xcaps & X_COMPACT) {
+      put64(node.tx.blocknum, bnum);
+      if(send_op(&node, OP_GET_CMPCT) == VEOK
+         && get_block3(&node, "cmpct.tmp") == 0)
+         status = cmp_build(&node, "cmpct.tmp", fname);
+      unlink("cmpct.tmp");
+   }
+   closesocket(node.sd);
+   if(Trace) plog("get_compact(): %s", status == VEOK ? "ok" : "failed");
+   return status;
+}  /* end get_compact() */
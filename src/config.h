@@ -57,24 +57,55 @@
 #define LQLEN         100      /* listen() queue length              */
 #define INIT_TIMEOUT  3        /* initial timeout after accept()     */
 #define ACK_TIMEOUT   10       /* timeout in callserver()            */
+#define HSLEN         32       /* handshakes in progress in server() */
+#define MAXACCEPT     8        /* acceptor() processes for -aN       */
+#define HOTBLOCKS     4        /* recent blocks cached by hb_add()   */
+#define HOTBYTES      (64L << 20)  /* their total size limit         */
+#define ACCQLEN       64       /* OP_TX ring of each acceptor()      */
+#define SESSIDLE      30       /* idle seconds before a session ends */
+#define SESSLEN       8        /* idle sessions kept by sess_put()   */
+#define BUSYLEN       8        /* OP_BUSY peers kept by busy_check() */
+#define LOADQUERY     60       /* Load % to shed queries -- load.c   */
+#define LOADTX        80       /* Load % to shed TX mirroring        */
+#define LOADRETRY     5        /* OP_BUSY retry-after seconds        */
+#define FOUNDLEN      16       /* OP_FOUND's in flight in found_all() */
+#define FOUNDTIME     10       /* seconds for all of them            */
+#define FOUNDRTT      500      /* msec. assumed for a new peer       */
+#define CMPFILL       16       /* TX's filled in by OP_GET_CMPCT     */
+#define INVPEERS      64       /* peers with a known tx_id set       */
+#define INVKNOWN      1024     /* tx_id's in each set (power of 2)   */
+#define MQLEN         1024     /* Mqring TX's to mirror (power of 2) */
+#define PFLEN         8        /* blocks in flight in pf_step()      */
+#define PFPEERS       8        /* peers pf_step() fetches from       */
+#define PFAHEAD       16       /* blocks fetched past last applied   */
+#define CUTF          256      /* trailers per OP_TF of catchup()    */
 #define TXQUEBIG      32       /* big enough to run bcon             */
+#define TXQMAX        32768    /* max TX's in txq1.dat + txclean.dat */
+#define MPSYNCLEN     64       /* mpsync.dat TX's per server loop    */
 #define MAXBLTX       32768    /* max TX's in a block for bcon (~1M) */
 #define STATUSFREQ    10       /* status display interval sec.       */
 #define BCDIR         "bc"     /* rename to dir for block storage    */
 #define NGDIR         "ng"     /* rename to dir for neogen storage   */
 #define WKDIR         "wk"     /* rename to dir for work storage     */
-#define CPINKLEN     100       /* maximum entries in pinklists       */
-#define LPINKLEN     100
-#define EPINKLEN     100
+#define PEERLEN      4096      /* pink list and rate table (power of 2) */
+#define EPINKLEN     1024      /* maximum entries in epink.lst       */
+#define BANTIME       300      /* first pinklist() ban in seconds    */
+#define BANSHIFT        8      /* ban doubles up to BANTIME << 8     */
+#define CONNRATE        4      /* connects per second per IP         */
+#define CONNBURST      32
+#define PTXRATE        64      /* OP_TX's per second per IP          */
+#define PTXBURST     1024
 #define EPOCHMASK     15       /* update pinklist Epoch count - 1    */
 #define EPOCHSHIFT    4
 #define RPLISTLEN     32       /* recent peer list v.28 */
 #define CPLISTLEN     8        /* current peer list */
-#define CRCLISTLEN    1024     /* recent tx crc's */
+#define CRCLISTLEN    1024     /* recent tx_id cache (power of 2) */
 #define MAXQUORUM     8        /* for get_eon() gang[] */
 
 #define BCONFREQ   10     /* Run con at least */
-#define CBITS      0      /* 8 capability bits for TX */
+#define CBITS      C_EXTCAP  /* 8 capability bits for TX */
+#define XCAPS      (X_MPSYNC | X_SESSION | X_RESUME | X_COMPACT \
+                    | X_INV)  /* ext. caps */
 /* Historic Compatibility Break Point Triggers */
 #define DTRIGGER31 17185  /* for v2.0 new set_difficulty() */
 #define WTRIGGER31 17185  /* for v2.0 new add_weight() */
@@ -94,7 +125,12 @@
                             && (get32(Cblocknum) >= V23TRIGGER \
                             || get32(Cblocknum+4) != 0))
 
-#define UBANDWIDTH 14300   /* Dynamic upload bandwidth -- not zero */
+/* Upload limits in KB/s for send_data() -- zero = no limit */
+#define BWRATE     0       /* all peers (-B) */
+#define BWPEER     0       /* each peer (-B,n) */
+#define BWBLOCK    0       /* each OP_GETBLOCK (-Ob) */
+#define BWTFILE    0       /* each OP_GET_TFILE (-Ob,t) */
+#define BWTF       0       /* each OP_TF (-Ob,t,f) */
 
 /* ------ end Dev Section  -----*/
 
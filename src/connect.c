@@ -44,3 +44,28 @@ retry:
    }
    return sd;
 }  /* end connectip() */
+
+
+/* Start a non-blocking connect() to ip.
+ * Returns the socket, which is writable once connected,
+ * or INVALID_SOCKET if it failed at once.
+ */
+SOCKET connect_nb(word32 ip)
+{
+   SOCKET sd;
+   struct sockaddr_in addr;
+
+   sd = socket(AF_INET, SOCK_STREAM, 0);
+   if(sd == INVALID_SOCKET) return INVALID_SOCKET;
+   nonblock(sd);
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_addr.s_addr = ip;
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(DSTPORT);
+   if(connect(sd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+      && errno != EINPROGRESS) {
+      closesocket(sd);
+      return INVALID_SOCKET;
+   }
+   return sd;
+}  /* end connect_nb() */
@@ -51,6 +51,17 @@ word16 Crc16table[] = {
 #define update_crc16(crc, c) \
    ( ((word16) (crc) << 8) ^ Crc16table[ ((word16) (crc) >> 8) ^ (byte) (c) ] )
 
+/* Continue CRC-CCITT crc over buff */
+word16 crc16x(word16 crc, void *buff, int len)
+{
+   byte *bp;
+
+   for(bp = buff; len; len--, bp++)
+      crc = update_crc16(crc, *bp);
+
+   return crc;
+}
+
 /* Compute CRC-CCITT on buff */
 word16 crc16(void *buff, int len)
 {
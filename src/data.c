@@ -27,10 +27,25 @@ word32 Nsent;        /* total TX sent                             */
 word32 Ngen;         /* total number of main loop iterations      */
 word32 Nsenderr;     /* number of send errors                     */
 word32 Ndups;        /* number of dup TX's received               */
+word32 Ntxprobes;    /* TX cache lookups in gettx()               */
+word32 Ntxhits;      /* TX cache hits (dups and known rejects)    */
 word32 Nsolved;      /* number of blocks solved by miner          */
 word32 Nupdated;     /* number of blocks updated                  */
 word32 Eon;          /* Eons since boot                           */
 word32 Txcount;      /* transactions in txq1.dat                  */
+word32 Nclean;       /* transactions in txclean.dat               */
+word32 Txqmax = TXQMAX;  /* cap on Txcount + Nclean                */
+word32 Nevicted;     /* low fee TX's evicted from the queues      */
+word32 Nqfull;       /* TX's refused by a full queue              */
+word32 Nlowfee;      /* TX's refused below the relay fee          */
+word32 Nthrottled;   /* connects and TX's over the per-IP rate    */
+word32 Nshed;        /* requests shed by load_shed()              */
+word32 Nmpsync;      /* TX's queued from peer mempools by mpsync  */
+word32 Nkbsent;      /* KB sent by finished send_data() children  */
+word32 Bwrate = BWRATE * 1024;  /* upload limit bytes/sec, all peers */
+word32 Bwpeer = BWPEER * 1024;  /* upload limit bytes/sec, each peer */
+/* upload limits bytes/sec of each OP_GETBLOCK, OP_GET_TFILE, OP_TF */
+word32 Bwop[3] = { BWBLOCK * 1024, BWTFILE * 1024, BWTF * 1024 };
 word32 Time0;        /* for set_difficulty()                      */
 word32 Bridgetime;   /* for Pseudoblock Trigger                   */
 word32 Sanctuary;
@@ -55,6 +70,10 @@ char *Wkdir = WKDIR;     /* work chain directory */
 #ifndef EXCLUDE_NODES
 NODE Nodes[MAXNODES];  /* data structure for connected NODE's     */
 NODE *Hi_node = Nodes; /* points one beyond last logged in NODE   */
+NODE Hsnodes[HSLEN];   /* handshakes in progress in server()      */
+int Acceptors;         /* acceptor() processes to run -aN         */
+pid_t Apid[MAXACCEPT]; /* their pid's in server()                 */
+int Acceptor;          /* in acceptor(): its index + 1            */
 
 word32 Rplist[RPLISTLEN];  /* recent peer list */
 word32 Rplistidx;
@@ -81,6 +100,7 @@ word32 Watchdog;        /* enable watchdog timeout -wN */
 time_t Utime;           /* update time for watchdog */
 byte Betabait;          /* betabait() display */
 byte Cbits = CBITS;     /* 8 capability bits */
+word32 Xcaps = XCAPS;   /* extended capability bits if C_EXTCAP */
 time_t Pushtime;        /* time of last OP_MBLOCK */
 byte Allowpush;         /* set by -P flag in mochimo.c */
 
@@ -88,6 +108,7 @@ byte Allowpush;         /* set by -P flag in mochimo.c */
 
 word32 Mfee[2] = { MFEE, 0 };  /* minimum transaction fee */
 word32 Myfee[2] = { MFEE, 0 };
+word32 Relayfee[2] = { MFEE, 0 };  /* minimum fee to queue and mirror */
 byte Maddr[TXADDRLEN];         /* mining address read by bcon and bval */
 word32 Difficulty;
 byte One[8] = { 1 };          /* for 64-bit maths */
@@ -98,7 +119,6 @@ byte Prevhash[HASHLEN];
 byte Weight[HASHLEN];
 
 /* lock files    writes   reads     deletes
- * mq.lck        gomochi            gomochi
  * neofail.lck   neogen   bupdata   bupdata
 */
 
@@ -119,4 +139,7 @@ byte Bcbnum[8];           /* Cblocknum at time of execl bcon */
 pid_t Sendfound_pid;
 pid_t Mpid;               /* miner */
 pid_t Mqpid;              /* mirror() */
-int Mqcount;              /* count of mq.dat records */
+pid_t Mspid;              /* mpsync() */
+pid_t Cupid;              /* catchup() */
+time_t Mpsynctime;        /* time to start mpsync() or zero */
+byte Mpsload;             /* mpsync.dat is being loaded */
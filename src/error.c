@@ -254,9 +254,17 @@ int stop_miner(void)
  */
 void fatal2(int exitcode, char *message)
 {
+#ifndef EXCLUDE_NODES
+   int j;
+#endif
+
    stop_miner();
    if(Sendfound_pid) kill(Sendfound_pid, SIGTERM);
 #ifndef EXCLUDE_NODES
+   for(j = 0; j < MAXACCEPT; j++)
+      if(Apid[j]) kill(Apid[j], SIGTERM);
+   if(Mspid) kill(Mspid, SIGTERM);
+   if(Cupid) kill(Cupid, SIGTERM);
    stop_mirror();
 #endif
    if(!Bgflag && message) {
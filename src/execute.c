@@ -55,55 +55,151 @@ void sendalrm(int sig)
    exit(1);  /* fail */
 }
 
+/* Send len bytes at data to np as OP_SEND_BL frames.
+ * A frame with less than TRANLEN bytes ends the stream.
+ * crcs[] is NULL, or holds crc16() of each TRANLEN bytes of data.
+ * Return VERROR on reset connection, else VEOK.
+ */
+int send_data(NODE *np, byte *data, long len, word16 *crcs)
+{
+   int n, status;
+
+   signal(SIGALRM, sendalrm);  /* set timeout handler */
+   bw_start(np);
+   for(n = TRANLEN, status = VERROR; Running; data += n, len -= n) {
+      n = len < TRANLEN ? len : TRANLEN;
+      bw_wait(np, txvlen(np, data, n));  /* upload limits */
+      alarm(10);
+      status = send_frame(np, OP_SEND_BL, data, n, crcs);
+      if(crcs) crcs++;
+      alarm(0);
+      if(n < TRANLEN || status != VEOK) break;
+   }  /* end for(; Running; ) */
+   bw_done(np);
+   if(n < TRANLEN) return status;  /* server does freeslot() */
+   return VERROR;
+}  /* end send_data() */
+
+
+/* Send len bytes from offset of a file mapped at map with size bytes.
+ * The range is cut to the end of the map, and len < 0 means all.
+ * Return VERROR on reset connection, else VEOK.
+ */
+int send_map(NODE *np, byte *map, long size, long offset, long len)
+{
+   if(offset < 0 || offset > size) offset = size;
+   if(len < 0 || len > size - offset) len = size - offset;
+   blocking(np->sd);   /* set blocking I/O for writev() */
+   signal(SIGBUS, sendalrm);  /* file was cut under the map */
+   return send_data(np, map ? map + offset : NULL, len, NULL);
+}
+
+
+/* Send len bytes of fname from offset to peer with send_map().
+ * The file is mmap()'d so no data is copied in user space.
+ * Return VERROR on file errors or reset connection, else VEOK.
+ */
+int send_range(NODE *np, char *fname, long offset, long len)
+{
+   struct stat st;
+   byte *map;
+   int fd, status;
+
+   fd = open(fname, O_RDONLY);
+   if(fd == -1 || fstat(fd, &st) != 0) {
+      if(Trace) plog("cannot open %s", fname);
+      if(fd != -1) close(fd);
+      sendnack(np);
+      return VERROR;
+   }
+   map = NULL;
+   if(st.st_size > 0) {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(map == MAP_FAILED) {
+         error("send_range(): cannot mmap() %s", fname);
+         close(fd);
+         sendnack(np);
+         return VERROR;
+      }
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+   }
+   close(fd);  /* the map holds the file */
+   if(Trace) plog("sending %s", fname);
+   status = send_map(np, map, st.st_size, offset, len);
+   if(map) munmap(map, st.st_size);
+   return status;
+}  /* end send_range() */
+
+
 /* Send block to peer  -- called by child
  * Return VERROR on file errors or reset connection, else VEOK.
  */
 int send_file(NODE *np, char *fname)
 {
-   byte *bnum;
-   TX *tx;
-   int n, status;
-   FILE *fp;
    char name[128];
 
-   tx = &np->tx;
-   bnum = tx->blocknum;
-
    show("send");
 
    if(fname == NULL) {
-      sprintf(name, "%s/b%s.bc", Bcdir, bnum2hex(bnum));
+      sprintf(name, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
       fname = name;
    }
-   fp = fopen(fname, "rb");
-   if(fp == NULL) {
-      if(Trace) plog("cannot open %s", fname);
-      sendnack(np);
-      return VERROR;
-   }
-   if(Trace) plog("sending %s", fname);
-   blocking(np->sd);   /* set blocking I/O for send() */
-   signal(SIGALRM, sendalrm);  /* set timeout handler */
-   for(; Running; ) {
-      n = fread(TRANBUFF(tx), 1, TRANLEN, fp);
-      put16(tx->len, n);
-      alarm(10);
-      status = send_op(np, OP_SEND_BL);
-      if(n < TRANLEN) {
-         alarm(0);
-         fclose(fp);
-         return status;  /* VEOK or VERROR -- server does freeslot() */
-      }
-      if(status != VEOK) break;
-      /* Make upload bandwidth dynamic. */
-      if(Nonline > 1) usleep((Nonline - 1) * UBANDWIDTH);
-   }  /* end for(; Running; ) */
-   alarm(0);
-   fclose(fp);
-   return VERROR;
+   return send_range(np, fname, 0, -1);
 }  /* end send_file() */
 
 
+/* Return the byte offset in an X_RESUME request in np, else zero.
+ * It is in tx.send_total -- see get_block2().
+ */
+long get_offset(NODE *np)
+{
+   long offset;
+
+   if((np->xcaps & Xcaps & X_RESUME) == 0) return 0;
+   offset = get32(np->tx.send_total + 4);
+   return ((offset << 16) << 16) | get32(np->tx.send_total);
+}
+
+
+/* Serve the SESS_FILE request in np, and then more of them while
+ * the session lasts.  The session ends on a send error, on another
+ * request class, or after SESSIDLE seconds idle.
+ * Returns VERROR if the last request failed, else VEOK.
+ */
+int send_files(NODE *np)
+{
+   char fname[128];
+   long offset;
+   int keep, status;
+
+   /* do not hold a child slot when busy */
+   keep = (np->xcaps & Xcaps & X_SESSION) && Nonline < MAXNODES / 2;
+   for(;;) {
+      offset = get_offset(np);
+      if(np->opcode == OP_GETBLOCK) {
+         status = hb_send(np, np->tx.blocknum, offset);  /* in memory? */
+         if(status == -1) {
+            show("send");
+            sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
+            status = send_range(np, fname, offset, -1);
+         }
+      }
+      else if(np->opcode == OP_GET_TFILE)
+         status = send_tfile(np, offset, -1);
+      else
+         status = send_tf(np);  /* OP_TF */
+      if(status != VEOK || !keep || !Running) break;
+      nonblock(np->sd);  /* send_range() set blocking */
+      if(rx2(np, 1, SESSIDLE) != VEOK) break;  /* idle or gone */
+      np->opcode = get16(np->tx.opcode);
+      if(sess_class(np->opcode) != SESS_FILE) break;
+      if(Trace) plog("send_files(): next opcode = %d", np->opcode);
+   }
+   closesocket(np->sd);
+   return status;
+}  /* end send_files() */
+
+
 /* Send our recent peer list to NODE np in response to OP_GETIPL.
  * Called from execute().
  */
@@ -127,23 +223,58 @@ int identify(NODE *np)
 }
 
 
+byte *Cbmap;          /* miner.tmp mapped for send_cblock() */
+long Cbsize;
+struct stat Cbstat;   /* of miner.tmp when mapped */
+
+
+/* Map miner.tmp read-only if the miner has a new candidate block.
+ * Called by gettx() in server(), so every send_cblock() child forks
+ * with the mapping.  The miner renames each new candidate in, so a
+ * new inode means a new block, and the old mapping is dropped without
+ * touching the children's.  Only the trailer is written in place,
+ * when the block is solved.
+ * Returns VEOK, or VERROR if there is no candidate block.
+ */
+int cb_map(void)
+{
+   struct stat st;
+   byte *map;
+   int fd;
+
+   if(stat("miner.tmp", &st) != 0) {
+      if(Cbmap) munmap(Cbmap, Cbsize);
+      Cbmap = NULL;
+      return VERROR;
+   }
+   if(Cbmap && st.st_ino == Cbstat.st_ino && st.st_dev == Cbstat.st_dev)
+      return VEOK;  /* same one */
+   fd = open("miner.tmp", O_RDONLY);
+   if(fd == -1) return VERROR;
+   if(fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return VERROR;
+   }
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED) return error("cb_map(): cannot mmap() miner.tmp");
+   if(Cbmap) munmap(Cbmap, Cbsize);
+   Cbmap = map;
+   Cbsize = st.st_size;
+   Cbstat = st;
+   if(Trace) plog("cb_map(): %ld bytes", Cbsize);
+   return VEOK;
+}  /* end cb_map() */
+
+
 /* Called from execute() in execute.c
+ * Send the candidate block mapped by cb_map().
  * Returns 0.
  */
 int send_cblock(NODE *np)
 {
-   char cmd[100], fname[32];
-   pid_t pid;
-
    show("sendcb");
-   if(exists("miner.tmp")) {
-      pid = getpid();
-      sprintf(fname, "cb%u.tmp", (int) pid);
-      sprintf(cmd, "cp miner.tmp %s", fname);
-      system(cmd);
-      send_file(np, fname);
-      unlink(fname);
-   }
+   if(Cbmap) send_map(np, Cbmap, Cbsize, 0, -1);
    return 0;
 }  /* end send_cblock() */
 
@@ -236,18 +367,19 @@ int execute(NODE *np)
           * Blockfound was set by gettx()
           */
          closesocket(np->sd);  /* close initial connection */
+         if((np->xcaps & Xcaps & X_COMPACT)
+            && get_compact(np->src_ip, np->tx.cblock, "rblock.dat") == VEOK)
+            return 0;
          if(get_block2(np->src_ip, np->tx.cblock, "rblock.dat",
                        OP_GETBLOCK) != VEOK) return 1;  /* fail */
          return 0;
       case OP_GETBLOCK:
-         /* send np->tx.blocknum to peer */
-         if(send_file(np, NULL) != VEOK) status = 1;
-         closesocket(np->sd);
-         return status;
       case OP_GET_TFILE:
-         /* send out tfile.dat to peer */
-         if(send_file(np, "tfile.dat") != VEOK) status = 1;
-         closesocket(np->sd);
+      case OP_TF:
+         /* send np->tx.blocknum, tfile.dat, or a section of it, and
+          * more while the session lasts
+          */
+         if(send_files(np) != VEOK) status = 1;
          return status;
       case OP_GET_CBLOCK:
          signal(SIGTERM, sendalrm);
@@ -259,11 +391,18 @@ int execute(NODE *np)
          get_mblock(np);
          closesocket(np->sd);
          return 0;
-      case OP_TF:
-         /* send tfile.dat section to peer */
-         send_tf(np);
+      case OP_GET_TXIDS:
+      case OP_GET_TXLIST:
+         /* send mempool tx_id's and TX's to peer */
+         if(send_mempool(np) != VEOK) status = 1;
          closesocket(np->sd);
-         return 0;
+         return status;
+      case OP_GET_CMPCT:
+      case OP_GET_BLTX:
+         /* send a block as tx_id's, then TX's by index */
+         if(send_compact(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
 
       default:
          Nbadlogs++;  /* bad OP's */
@@ -0,0 +1,198 @@
+/* found.c  Announce a found block to all peers at once
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * found_all() runs in the send_found() child.  It starts non-blocking
+ * connects to the peers of Rplist[] and Lplist[], up to FOUNDLEN at
+ * a time, fastest first by the round trip times kept in found.lst.
+ * Each one is stepped through OP_HELLO, OP_HELLO_ACK and OP_FOUND with
+ * poll(), so a dead peer costs a slot and not the time of the others.
+ * All of them share one deadline of FOUNDTIME seconds.  The time to
+ * OP_HELLO_ACK and the counts of good and failed sends for each peer
+ * go back to found.lst for the next block.
+*/
+
+
+#define FOUNDLST  "found.lst"
+
+typedef struct {
+   word32 ip;
+   word32 rtt;     /* msec. to OP_HELLO_ACK, averaged */
+   word32 nok;     /* OP_FOUND's sent */
+   word32 nfail;   /* sends that failed or ran out of time */
+} FOUNDPEER;
+
+typedef struct {
+   NODE node;
+   FOUNDPEER *fp;
+   int state;      /* FS_IDLE, FS_CONNECT, or FS_ACK */
+   double start;   /* of connect() */
+   word32 rtt;     /* msec. from start to OP_HELLO_ACK */
+} FOUNDSLOT;
+
+#define FS_IDLE     0
+#define FS_CONNECT  1   /* waiting for connect() */
+#define FS_ACK      2   /* waiting for OP_HELLO_ACK */
+
+int Nfound;   /* OP_FOUND's sent by found_all() */
+
+
+int found_cmp(const void *a, const void *b)
+{
+   word32 ra, rb;
+
+   ra = ((FOUNDPEER *) a)->rtt;
+   rb = ((FOUNDPEER *) b)->rtt;
+   return ra < rb ? -1 : ra > rb;
+}
+
+
+/* Fill peer[] with the ip's of Rplist[] and Lplist[] and what
+ * found.lst knows of them, fastest first.  Returns the count.
+ */
+int found_peers(FOUNDPEER *peer)
+{
+   static FOUNDPEER old[RPLISTLEN + LPLISTLEN];
+   word32 ip;
+   int j, k, n, nold;
+
+   nold = read_data(old, sizeof(old), FOUNDLST) / sizeof(FOUNDPEER);
+   for(n = k = 0; k < RPLISTLEN + LPLISTLEN; k++) {
+      ip = k < RPLISTLEN ? Rplist[k] : Lplist[k - RPLISTLEN];
+      if(ip == 0) continue;
+      for(j = 0; j < n; j++) if(peer[j].ip == ip) break;
+      if(j < n) continue;  /* in both lists */
+      for(j = 0; j < nold; j++) if(old[j].ip == ip) break;
+      if(j < nold) peer[n] = old[j];
+      else {
+         memset(&peer[n], 0, sizeof(FOUNDPEER));
+         peer[n].ip = ip;
+         peer[n].rtt = FOUNDRTT;  /* new peers in the middle */
+      }
+      n++;
+   }
+   qsort(peer, n, sizeof(FOUNDPEER), found_cmp);
+   return n;
+}  /* end found_peers() */
+
+
+/* Start a non-blocking connect() to fp->ip in slot sp.
+ * Returns VEOK, or VERROR if it failed at once.
+ */
+int found_connect(FOUNDSLOT *sp, FOUNDPEER *fp)
+{
+   SOCKET sd;
+
+   sd = connect_nb(fp->ip);
+   if(sd == INVALID_SOCKET) return VERROR;
+   memset(&sp->node, 0, sizeof(NODE));
+   sp->node.sd = sd;
+   sp->node.src_ip = fp->ip;
+   sp->fp = fp;
+   sp->state = FS_CONNECT;
+   sp->start = bw_now();
+   return VEOK;
+}  /* end found_connect() */
+
+
+/* Close slot sp and count the result for its peer. */
+void found_done(FOUNDSLOT *sp, int ok)
+{
+   word32 rtt;
+
+   rtt = sp->rtt;
+   closesocket(sp->node.sd);
+   sp->state = FS_IDLE;
+   if(!ok) {
+      sp->fp->nfail++;
+      sp->fp->rtt = FOUNDTIME * 1000;  /* to the back */
+      return;
+   }
+   Nfound++;
+   sp->fp->rtt = sp->fp->nok ? (sp->fp->rtt * 3 + rtt) / 4 : rtt;
+   sp->fp->nok++;
+}
+
+
+/* Step slot sp after poll() says it is ready. */
+void found_step(FOUNDSLOT *sp, TX *tx)
+{
+   NODE *np;
+   int err, status;
+   socklen_t len;
+
+   np = &sp->node;
+   if(sp->state == FS_CONNECT) {
+      len = sizeof(err);
+      if(getsockopt(np->sd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) != 0
+         || err != 0) {
+         found_done(sp, 0);
+         return;
+      }
+      np->id1 = rand16();
+      if(send_op(np, OP_HELLO) != VEOK) {
+         found_done(sp, 0);
+         return;
+      }
+      sp->state = FS_ACK;
+      return;
+   }
+   /* FS_ACK */
+   status = rx_step(np);
+   if(status == -1) return;  /* not all here yet */
+   if(status != VEOK || rxcheck(np, 0) != VEOK
+      || get16(np->tx.opcode) != OP_HELLO_ACK
+      || get16(np->tx.id1) != np->id1) {
+      found_done(sp, 0);
+      return;
+   }
+   sp->rtt = (bw_now() - sp->start) * 1000;
+   np->id2 = get16(np->tx.id2);
+   np->caps = np->tx.version[1];
+   np->xcaps = get_xcaps(&np->tx);
+   memcpy(&np->tx, tx, sizeof(TX));  /* copy in tfile proof */
+   found_done(sp, send_op(np, OP_FOUND) == VEOK);
+}  /* end found_step() */
+
+
+/* Send OP_FOUND with proof tx to all peers at once  -- in child */
+void found_all(TX *tx)
+{
+   static FOUNDPEER peer[RPLISTLEN + LPLISTLEN];
+   static FOUNDSLOT slot[FOUNDLEN];
+   struct pollfd pfd[FOUNDLEN];
+   FOUNDSLOT *sp, *ready[FOUNDLEN];
+   time_t deadline;
+   double t0;
+   int j, n, next, nfds;
+
+   n = found_peers(peer);
+   deadline = time(NULL) + FOUNDTIME;
+   t0 = bw_now();
+   for(next = 0; Running && time(NULL) < deadline; ) {
+      for(sp = slot; sp < &slot[FOUNDLEN] && next < n; sp++) {
+         if(sp->state != FS_IDLE) continue;
+         while(next < n && found_connect(sp, &peer[next]) != VEOK)
+            peer[next++].nfail++;
+         if(sp->state != FS_IDLE) next++;
+      }
+      for(nfds = 0, sp = slot; sp < &slot[FOUNDLEN]; sp++) {
+         if(sp->state == FS_IDLE) continue;
+         pfd[nfds].fd = sp->node.sd;
+         pfd[nfds].events = sp->state == FS_CONNECT ? POLLOUT : POLLIN;
+         ready[nfds++] = sp;
+      }
+      if(nfds == 0) break;  /* all done */
+      if(poll(pfd, nfds, 100) <= 0) continue;
+      for(j = 0; j < nfds; j++)
+         if(pfd[j].revents) found_step(ready[j], tx);
+   }  /* end for */
+   for(sp = slot; sp < &slot[FOUNDLEN]; sp++)
+      if(sp->state != FS_IDLE) found_done(sp, 0);  /* out of time */
+   write_data(peer, n * sizeof(FOUNDPEER), FOUNDLST);
+   if(Trace) plog("found_all(): %d of %d peers in %d msec.", Nfound, n,
+                  (int) ((bw_now() - t0) * 1000));
+}  /* end found_all() */
@@ -31,15 +31,9 @@ int freeslot(NODE *np)
 }  /* end freeslot() */
 
 
-/* Send packet: set advertised fields and crc16.
- * Returns VEOK on success, else VERROR.
- */
-int sendtx(NODE *np)
+/* Set advertised fields of np->tx for sendtx() and send_frame(). */
+void settxhdr(NODE *np)
 {
-   int count, len;
-   time_t timeout;
-   byte *buff;
-
    np->tx.version[0] = PVERSION;
    np->tx.version[1] = Cbits;
    put16(np->tx.network, TXNETWORK);
@@ -48,31 +42,135 @@ int sendtx(NODE *np)
    put16(np->tx.id1, np->id1);
    put16(np->tx.id2, np->id2);
    put64(np->tx.cblock, Cblocknum);  /* 64-bit little-endian */
+   if(get16(np->tx.opcode) == OP_HELLO
+      || get16(np->tx.opcode) == OP_HELLO_ACK)
+         put32(np->tx.blocknum, Xcaps);  /* see C_EXTCAP */
    memcpy(np->tx.cblockhash, Cblockhash, HASHLEN);
    memcpy(np->tx.pblockhash, Prevhash, HASHLEN);
    if(get16(np->tx.opcode) != OP_TX)  /* do not copy over TX ip map */
       memcpy(np->tx.weight, Weight, HASHLEN);
-   crctx(&np->tx);
-   count = send(np->sd, TXBUFF(&np->tx), TXBUFFLEN, 0);
-   if(count == TXBUFFLEN) return VEOK;
-   /* --- v20 retry */
-   if(Trace) plog("sendtx(): send() retry...");
-   timeout = time(NULL) + 10;
-   for(len = TXBUFFLEN, buff = TXBUFF(&np->tx); ; ) {
-      if(count == 0) break;
-      if(count > 0) { buff += count; len -= count; }
-      else {
-         if(errno != EWOULDBLOCK || time(NULL) >= timeout) break;
+}  /* end settxhdr() */
+
+
+/* Send the n buffers at vp to np->sd in order, retrying partial sends.
+ * Returns VEOK on success, else VERROR.
+ */
+int sendv(NODE *np, struct iovec *vp, int n)
+{
+   int count;
+   time_t timeout;
+
+   for(timeout = 0; n > 0; ) {
+      count = writev(np->sd, vp, n);
+      if(count < 0) {
+         if(errno != EWOULDBLOCK && errno != EINTR) break;
+         /* --- v20 retry */
+         if(timeout == 0) {
+            if(Trace) plog("sendv(): writev() retry...");
+            timeout = time(NULL) + 10;
+         }
+         if(time(NULL) >= timeout) break;
+         continue;
+      }
+      /* skip what was sent */
+      for( ; n > 0 && count >= (int) vp->iov_len; n--, vp++)
+         count -= vp->iov_len;
+      if(n > 0) {
+         vp->iov_base = (byte *) vp->iov_base + count;
+         vp->iov_len -= count;
       }
-      count = send(np->sd, buff, len, 0);
-      if(count == len) return VEOK;
    }
-   /* --- v20 end */
+   if(n == 0) return VEOK;
    Nsenderr++;
    if(Trace)
-      plog("send() error: count = %d  errno = %d", count, errno);
+      plog("send() error: errno = %d", errno);
    return VERROR;
-}  /* end sendtx() */
+}  /* end sendv() */
+
+
+/* Return crc16x(crc, zeros, TRANLEN) with one table entry per bit of
+ * crc.  CRC-CCITT with zero init is linear, so
+ * crc16x(crc, data, TRANLEN) == crc_tranlen(crc) ^ crc16(data, TRANLEN).
+ */
+word16 crc_tranlen(word16 crc)
+{
+   static word16 basis[16];
+   static byte zeros[TRANLEN];
+   word16 out;
+   int j;
+
+   if(basis[0] == 0)  /* never zero once set */
+      for(j = 0; j < 16; j++) basis[j] = crc16x(1 << j, zeros, TRANLEN);
+   for(out = 0, j = 0; crc; j++, crc >>= 1)
+      if(crc & 1) out ^= basis[j];
+   return out;
+}
+
+
+/* Send the header in np->tx with len bytes at data as the transaction
+ * buffer followed by zeros, so data need not be copied into np->tx.
+ * If both ends have C_VARLEN, the frame after the handshake is sent
+ * compact: a 2-byte count n, the first n bytes of the TX with the
+ * trailing zeros cut, then crc16 over those n bytes and the trailer.
+ * dcrc, if not NULL, is crc16(data, TRANLEN) worked out ahead, and is
+ * used when len is TRANLEN.
+ * Returns VEOK on success, else VERROR.
+ */
+int sendtxv(NODE *np, void *data, int len, word16 *dcrc)
+{
+   static byte zeros[TRANLEN];
+   struct iovec iov[4];
+   byte count[2];
+   TX *tx;
+   word16 crc;
+   int hdrlen;
+
+   tx = &np->tx;
+   hdrlen = TRANBUFF(tx) - TXBUFF(tx);
+   settxhdr(np);
+   crc = crc16(TXBUFF(tx), hdrlen);
+   if(varlen(np)) {
+      while(len > 0 && ((byte *) data)[len - 1] == 0) len--;
+      put16(count, hdrlen + len);
+      if(dcrc && len == TRANLEN) crc = crc_tranlen(crc) ^ *dcrc;
+      else crc = crc16x(crc, data, len);
+      put16(tx->crc16, crc);
+      iov[0].iov_base = count;       iov[0].iov_len = 2;
+      iov[1].iov_base = TXBUFF(tx);  iov[1].iov_len = hdrlen;
+      iov[2].iov_base = data;        iov[2].iov_len = len;
+      iov[3].iov_base = tx->crc16;   iov[3].iov_len = 4;  /* and trailer */
+      return sendv(np, iov, 4);
+   }
+   if(dcrc && len == TRANLEN) crc = crc_tranlen(crc) ^ *dcrc;
+   else {
+      crc = crc16x(crc, data, len);
+      crc = crc16x(crc, zeros, TRANLEN - len);
+   }
+   put16(tx->crc16, crc);
+   iov[0].iov_base = TXBUFF(tx);  iov[0].iov_len = hdrlen;
+   iov[1].iov_base = data;        iov[1].iov_len = len;
+   iov[2].iov_base = zeros;       iov[2].iov_len = TRANLEN - len;
+   iov[3].iov_base = tx->crc16;   iov[3].iov_len = 4;  /* and trailer */
+   return sendv(np, iov, 4);
+}  /* end sendtxv() */
+
+
+/* Return the bytes sendtxv() puts on the wire for len bytes at data. */
+int txvlen(NODE *np, void *data, int len)
+{
+   if(!varlen(np)) return TXBUFFLEN;
+   while(len > 0 && ((byte *) data)[len - 1] == 0) len--;
+   return 2 + (TRANBUFF(&np->tx) - TXBUFF(&np->tx)) + len + 4;
+}
+
+
+/* Send packet: set advertised fields and crc16.
+ * Returns VEOK on success, else VERROR.
+ */
+int sendtx(NODE *np)
+{
+   return sendtxv(np, TRANBUFF(&np->tx), TRANLEN, NULL);
+}
 
 
 int send_op(NODE *np, int opcode)
@@ -82,6 +180,19 @@ int send_op(NODE *np, int opcode)
 }
 
 
+/* Send opcode with len bytes at data as the transaction buffer
+ * without copying data into np->tx.  dcrc is as for sendtxv().
+ * np->sd should be blocking.
+ * Returns VEOK on success, else VERROR.
+ */
+int send_frame(NODE *np, int opcode, void *data, int len, word16 *dcrc)
+{
+   put16(np->tx.opcode, opcode);
+   put16(np->tx.len, len);
+   return sendtxv(np, data, len, dcrc);
+}  /* end send_frame() */
+
+
 /* A Basic block validator for catchup().
  * Every non-NG block should pass this test.
  * If it does not, the error is intentional (pink-list).
@@ -120,36 +231,6 @@ int bval2(char *fname, byte *bnum, byte diff)
 }  /* end bval2() */
 
 
-/* Catch up by getting blocks: all else waits...
- * Return VERROR if contention, else VEOK.
- */
-int catchup(word32 peerip)
-{
-   byte bnum[8];
-   int count, status;
-
-   if(Trace) plog("catchup(%s)", ntoa((byte *) &peerip));
-
-   put64(bnum, Cblocknum);
-   for(count = 0; Running; ) {
-      add64(bnum, One, bnum);
-      if(bnum[0] == 0) continue;  /* do not fetch NG blocks */
-      if(get_block2(peerip, bnum, "rblock.dat", OP_GETBLOCK) != VEOK) break;
-      status = bval2("rblock.dat", bnum, Difficulty);
-      if(status != VEOK) {
-         if(status == VEBAD) epinklist(peerip);
-         break;
-      }
-      if(update("rblock.dat", 0) != VEOK) {
-         if(count == 0) return VERROR;  /* contention */
-         break;  /* ignore */
-      }
-      count++;
-   }  /* end for count */
-   return VEOK;
-}  /* end catchup() */
-
-
 /* Handle contention
  * Returns:  0 = ignore
  *           1 = do fetch block with child
@@ -183,11 +264,10 @@ int contention(NODE *np)
       }
    }  /* end if result == 0 -- one block ahead */
 
-   /* more than one block ahead or bad hash */
-   if(catchup(np->src_ip) != VEOK && checkproof(tx) != VEOK) {
-      write_data(&np->src_ip, 4, "rplist.lst");
-      restart("contend");  /* Contention - RESTART */
-   }
+   /* more than one block ahead or bad hash:
+    * cu_apply() checks the proof if it comes to contention
+    */
+   catchup(np->src_ip, tx);
    return 0;
 }  /* end contention() */
 
@@ -342,92 +422,193 @@ int check_work(NODE *np)
 } /* end check_work() */
 
 
+/* Queue the TX in np->tx from gettx() or mpsync_load()  -- in parent
+ * Returns -1 on a duplicate, 0 if queued, else the process_tx()
+ * reject code.
+ */
+int tx_in(NODE *np)
+{
+   int status;
+   byte tx_id[HASHLEN];
+
+   status = txcache_find(&np->tx, tx_id);  /* one probe for dups */
+   if(status == TXC_ACCEPT) {
+      Ndups++;
+      return -1;
+   }
+   if(get16(np->tx.len) == 0) inv_add(np->src_ip, tx_id);  /* not wallet */
+   if(status != TXC_EMPTY) return status;  /* rejected before */
+   if(txcheck(np->tx.src_addr) != VEOK) {
+      if(Trace) plog("got dup src_addr");
+      Ndups++;
+      txcache_add(&np->tx, tx_id, TXC_ACCEPT);
+      return -1;
+   }
+   Nlogins++;  /* raw TX in */
+   status = process_tx(np);
+   txcache_add(&np->tx, tx_id, status ? status : TXC_ACCEPT);
+   return status;
+}  /* end tx_in() */
+
+
+/* Take the OP_TX in np, already read and checked  -- in parent,
+ * from gettx() or from acc_poll() for an acceptor().
+ * Returns 0, or the tx_in() reject code if src_ip is to be pink
+ * listed: 2 for pinklist(), more for epinklist() as well.
+ */
+int tx_recv(NODE *np)
+{
+   int status;
+
+   if(peer_take(np->src_ip, PT_TX) != VEOK) {
+      Nthrottled++;
+      return 0;  /* drop it */
+   }
+   status = tx_in(np);
+   if(status < 0) return 0;  /* dup */
+   if(status > 1) return status;
+   if(get16(np->tx.len) == 0) {  /* do not add wallets */
+      addcurrent(np->src_ip);    /* add to peer lists */
+      addrecent(np->src_ip);
+   }
+   return 0;
+}  /* end tx_recv() */
+
+
 /* opcodes in types.h */
 #define valid_op(op)  ((op) >= FIRST_OP && (op) <= LAST_OP)
-#define crowded(op)   (Nonline > (MAXNODES - 5) && (op) != OP_FOUND)
-#define can_fork_tx() (Nonline <= (MAXNODES - 5))
+
+/* Start a handshake in an Hsnodes[] slot for accept()'ed sd.
+ * Returns VEOK, or 2 if the src_ip is pinklisted or over its rate.
+ */
+int hs_open(NODE *np, SOCKET sd)
+{
+   memset(np, 0, sizeof(NODE));  /* clear structure */
+   np->sd = sd;
+   np->src_ip = getsocketip(sd);  /* uses getpeername() */
+
+   /*
+    * There are many ways to be bad...
+    * Check pink lists...
+    */
+   if(pinklisted(np->src_ip)) {
+      Nbadlogs++;
+      return 2;
+   }
+   if(peer_take(np->src_ip, PT_CONNECT) != VEOK) {
+      Nthrottled++;
+      return 2;
+   }
+   np->state = HS_HELLO;
+   np->deadline = time(NULL) + INIT_TIMEOUT;
+   return VEOK;
+}  /* end hs_open() */
+
+
+/* Close the sockets of all handshakes in progress  -- in child */
+void hs_closeall(void)
+{
+   NODE *np;
+
+   for(np = Hsnodes; np < &Hsnodes[HSLEN]; np++) {
+      if(np->state == HS_IDLE) continue;
+      closesocket(np->sd);
+      np->state = HS_IDLE;
+   }
+}
+
+
+/* After a SESS_PARENT request, keep np open for the next request
+ * if both ends have X_SESSION and Hsnodes[] is not half sessions.
+ * Returns -1 to keep np, else 1 to close it.
+ */
+int hs_keep(NODE *np)
+{
+   NODE *hp;
+   int n;
+
+   if((np->xcaps & Xcaps & X_SESSION) == 0) return 1;
+   for(n = 0, hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++)
+      if(hp->state == HS_SESS) n++;
+   if(n >= HSLEN / 2) return 1;
+   np->state = HS_SESS;
+   np->deadline = time(NULL) + SESSIDLE;
+   return -1;
+}  /* end hs_keep() */
+
 
 /**
  * Listen gettx()   (still in parent)
- * Reads a TX structure from SOCKET sd.  Handles 3-way and 
- * validates crc and id's.  Also cares for requests that do not need
- * a child process.
+ * Steps the handshake of Hsnodes[] slot np started by hs_open().
+ * Reads what has arrived of a TX structure from np->sd, handles 3-way,
+ * and validates crc and id's without waiting on the peer.
+ * Also cares for requests that do not need a child process.
  *
  * Returns:
- *          -1 no data yet
+ *          -1 handshake or session still in progress
  *          0 connection reset
  *          sizeof(TX) to create child NODE to process read np->tx
  *          1 to close connection ("You're done, tx")
  *          2 src_ip was pinklisted (She was very naughty.)
  *
- * On entry: sd is non-blocking.
+ * On entry: np->sd is non-blocking.
  *
  * Op sequence: OP_HELLO,OP_HELLO_ACK,OP_(?x)
  */
-int gettx(NODE *np, SOCKET sd)
+int gettx(NODE *np)
 {
-   int count, status, n;
+   int count, status;
    word16 opcode;
    TX *tx;
-   word32 ip;
-   time_t timeout;
 
    tx = &np->tx;
-   memset(np, 0, sizeof(NODE));  /* clear structure */
-   np->sd = sd;
-   np->src_ip = ip = getsocketip(sd);  /* uses getpeername() */
-
-   /*
-    * There are many ways to be bad...
-    * Check pink lists...
-    */
-   if(pinklisted(ip)) {
-      Nbadlogs++;
-      return 2;
+   if(np->state == HS_READY) status = VEOK;  /* from acc_poll() */
+   else status = rx_step(np);
+   if(status == -1) {
+      if(time(NULL) < np->deadline) return -1;  /* no data yet */
+      if(np->state == HS_SESS && np->rlen == 0) return 1;  /* idle */
+      Ntimeouts++;
+      return 1;
    }
-
-   n = recv(sd, TXBUFF(tx), TXBUFFLEN, 0);
-   if(n <= 0) return n;
-   timeout = time(NULL) + 3;
-   for( ; n != TXBUFFLEN; ) {
-      count = recv(sd, TXBUFF(tx) + n, TXBUFFLEN - n, 0);
-      if(count == 0) return 1;
-      if(count < 0) {
-         if(time(NULL) >= timeout) { Ntimeouts++; return 1; }
-         continue;
+   if(status == VEBAD) { opcode = 0; goto bad2; }  /* bad frame count */
+   if(status != VEOK) return np->state == HS_HELLO ? 0 : VERROR;
+   count = TXBUFFLEN;
+
+   if(np->state == HS_HELLO) {
+      /*
+       * validate packet and return 1 if bad.
+       */
+      opcode = get16(tx->opcode);
+      if(rxcheck(np, 0) != VEOK) {
+         if(Trace) plog("gettx(): bad packet");
+         return 1;  /* BAD packet */
+      }
+      if(tx->version[0] != PVERSION) {
+         if(Trace) plog("gettx(): bad version");
+         return 1;
       }
-      n += count;  /* collect the full TX */
+      if(Trace) plog("gettx(): crc16 good");
+      if(opcode != OP_HELLO) goto bad1;
+      np->id1 = get16(tx->id1);
+      np->id2 = rand16();
+      np->caps = tx->version[1];
+      np->xcaps = get_xcaps(tx);
+      if(Acceptor) acc_gettip();  /* tip of server() for settxhdr() */
+      if(send_op(np, OP_HELLO_ACK) != VEOK) return VERROR;
+      np->state = HS_OP;
+      np->deadline = time(NULL) + 3;
+      return -1;  /* wait for request */
    }
-   count = n;
 
-   /*
-    * validate packet and return 1 if bad.
-    */
-   opcode = get16(tx->opcode);
-   if(get16(tx->network) != TXNETWORK
-      || get16(tx->trailer) != TXEOT
-      || crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16) ) {
-            if(Trace) plog("gettx(): bad packet");
-            return 1;  /* BAD packet */
-   }
-   if(tx->version[0] != PVERSION) {
-      if(Trace) plog("gettx(): bad version");
-      return 1;
-   }
-   
-   if(Trace) plog("gettx(): crc16 good");
-   if(opcode != OP_HELLO) goto bad1;
-   np->id1 = get16(tx->id1);
-   np->id2 = rand16();
-   if(send_op(np, OP_HELLO_ACK) != VEOK) return VERROR;
-   status = rx2(np, 1, 3);
+   status = rxcheck(np, 1);
    opcode = get16(tx->opcode);
    if(Trace)
       plog("gettx(): got opcode = %d  status = %d", opcode, status);
    if(status == VEBAD) goto bad2;
-   if(status != VEOK) return VERROR;  /* bad packet -- timeout? */
    np->opcode = opcode;  /* execute() will check the opcode */
    if(!valid_op(opcode)) goto bad1;  /* she was a bad girl */
+   if(Acceptor) return acc_request(np);  /* server() does the rest */
+   if(load_shed(np)) return 1;  /* OP_BUSY -- see load.c */
 
    if(opcode == OP_GETIPL) {
       send_ipl(np);
@@ -435,23 +616,16 @@ int gettx(NODE *np, SOCKET sd)
          addcurrent(np->src_ip);  /* v.28 */
          addrecent(np->src_ip);
       }
-      return 1;  /* You're done! */
+      return hs_keep(np);  /* You're done! */
    }
    else if(opcode == OP_TX) {
-      if(txcheck(tx->src_addr) != VEOK) {
-         if(Trace) plog("got dup src_addr");
-         Ndups++;
-         return 1;  /* suppress child */
-      }
-      Nlogins++;  /* raw TX in */
-      status = process_tx(np);
+      status = tx_recv(np);
       if(status > 2) goto bad1;
       if(status > 1) goto bad2;
-      if(get16(np->tx.len) == 0) {  /* do not add wallets */
-         addcurrent(np->src_ip);    /* add to peer lists */
-         addrecent(np->src_ip);
-      }
-      return 1;  /* no child */
+      return hs_keep(np);  /* no child */
+   } else if(opcode == OP_INV) {
+      if(inv_recv(np) != VEOK) return 1;
+      return hs_keep(np);  /* OP_TX's to follow */
    } else if(opcode == OP_FOUND) {
       if(Blockfound) return 1;  /* Already found one so ignore.  */
       /* Check if this is our worker */
@@ -492,27 +666,27 @@ int gettx(NODE *np, SOCKET sd)
    } else if(opcode == OP_BALANCE) {
       send_balance(np);
       Nsent++;
-      return 1;  /* no child */
+      return hs_keep(np);  /* no child */
    } else if(opcode == OP_RESOLVE) {
       tag_resolve(np);
-      return 1;
+      return hs_keep(np);
    } else if(opcode == OP_GET_CBLOCK) {
-      if(!Allowpush || !exists("miner.tmp")) return 1;
+      if(!Allowpush || cb_map() != VEOK) return 1;
    } else if(opcode == OP_MBLOCK) {
       if(!Allowpush || (time(NULL) - Pushtime) < 150) return 1;
       Pushtime = time(NULL);
+   } else if(opcode == OP_GETBLOCK || opcode == OP_GET_CMPCT) {
+      hb_touch(np->tx.blocknum);  /* for the child's cache */
    } else if(opcode == OP_HASH) {
-      send_hash(np);
-      return 1;
+      if(send_hash(np) != VEOK) return 1;
+      return hs_keep(np);
    } else if(opcode == OP_IDENTIFY) {
       identify(np);
-      return 1;
+      return hs_keep(np);
    }
 
-   if(opcode == OP_BUSY || opcode == OP_NACK || opcode == OP_HELLO_ACK)
-      return 1;  /* no child needed */
-   /* If too many children in too small a space... */
-   if(crowded(opcode)) return 1;  /* suppress child unless OP_FOUND */
+   if(opcode == OP_BUSY || opcode == OP_NACK || opcode == OP_HELLO_ACK
+      || opcode == OP_INV_WANT) return 1;  /* no child needed */
    return count;  /* success -- fork() child in server() */
 
 bad1: epinklist(np->src_ip);
@@ -0,0 +1,142 @@
+/* hotblock.c  Recent blocks kept in memory for OP_GETBLOCK
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * Right after a block is solved, many peers ask for the same block at
+ * once.  update() reads each new block into Hotblock[] in server(),
+ * with crc16() of each TRANLEN chunk worked out ahead for sendtxv().
+ * Children forked by server() inherit the cache copy-on-write and
+ * send a hit straight from memory.  gettx() marks use, so the least
+ * recently asked for block goes first when HOTBLOCKS or HOTBYTES
+ * would be passed.
+*/
+
+
+typedef struct {
+   byte bnum[8];      /* block number, zero if empty */
+   byte *data;        /* block file */
+   long size;
+   word16 *crcs;      /* crc16() of each TRANLEN bytes of data */
+   time_t used;       /* last OP_GETBLOCK, for LRU */
+} HOTBLOCK;
+
+HOTBLOCK Hotblock[HOTBLOCKS];
+long Hotbytes;        /* total size of cached blocks */
+
+
+/* Return the cache entry of bnum, or NULL. */
+HOTBLOCK *hb_find(byte *bnum)
+{
+   HOTBLOCK *hp;
+
+   for(hp = Hotblock; hp < &Hotblock[HOTBLOCKS]; hp++)
+      if(hp->data && cmp64(hp->bnum, bnum) == 0) return hp;
+   return NULL;
+}
+
+
+void hb_free(HOTBLOCK *hp)
+{
+   if(hp->data == NULL) return;
+   free(hp->data);
+   free(hp->crcs);
+   Hotbytes -= hp->size;
+   memset(hp, 0, sizeof(HOTBLOCK));
+}
+
+
+/* Read block bnum from Bcdir into the cache  -- in server().
+ * Returns VEOK, or VERROR if it is not cached.
+ */
+int hb_add(byte *bnum)
+{
+   HOTBLOCK *hp, *lru, *empty;
+   char fname[128];
+   struct stat st;
+   FILE *fp;
+   long j;
+
+   if(hb_find(bnum)) return VEOK;
+   sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(bnum));
+   if(stat(fname, &st) != 0 || st.st_size > HOTBYTES) return VERROR;
+   /* make room */
+   for(;;) {
+      lru = empty = NULL;
+      for(hp = Hotblock; hp < &Hotblock[HOTBLOCKS]; hp++) {
+         if(hp->data == NULL) empty = hp;
+         else if(lru == NULL || hp->used < lru->used) lru = hp;
+      }
+      if(empty && Hotbytes + st.st_size <= HOTBYTES) break;
+      hb_free(lru);
+   }
+   hp = empty;
+   hp->data = malloc(st.st_size + 1);
+   hp->crcs = malloc((st.st_size / TRANLEN + 1) * sizeof(word16));
+   if(hp->data == NULL || hp->crcs == NULL) goto bad;
+   fp = fopen(fname, "rb");
+   if(fp == NULL) goto bad;
+   if(fread(hp->data, 1, st.st_size, fp) != (size_t) st.st_size) {
+      fclose(fp);
+      goto bad;
+   }
+   fclose(fp);
+   for(j = 0; j + TRANLEN <= st.st_size; j += TRANLEN)
+      hp->crcs[j / TRANLEN] = crc16(hp->data + j, TRANLEN);
+   put64(hp->bnum, bnum);
+   hp->size = st.st_size;
+   hp->used = time(NULL);
+   Hotbytes += hp->size;
+   if(Trace) plog("hb_add(): 0x%s %ld bytes", bnum2hex(bnum), hp->size);
+   return VEOK;
+bad:
+   free(hp->data);
+   free(hp->crcs);
+   hp->data = NULL;
+   hp->crcs = NULL;
+   return VERROR;
+}  /* end hb_add() */
+
+
+/* Cache the blocks of the last update()  -- in server() */
+void hb_update(void)
+{
+   byte bnum[8];
+
+   put64(bnum, Cblocknum);
+   hb_add(bnum);
+   if(Cblocknum[0] == 0) {  /* and the block before neo-genesis */
+      sub64(bnum, One, bnum);
+      hb_add(bnum);
+   }
+}
+
+
+/* Mark bnum as used by an OP_GETBLOCK  -- in gettx() */
+void hb_touch(byte *bnum)
+{
+   HOTBLOCK *hp;
+
+   hp = hb_find(bnum);
+   if(hp) hp->used = time(NULL);
+}
+
+
+/* Send block bnum from offset from the cache  -- in child.
+ * Returns VEOK or VERROR like send_file(), or -1 on a miss.
+ */
+int hb_send(NODE *np, byte *bnum, long offset)
+{
+   HOTBLOCK *hp;
+
+   hp = hb_find(bnum);
+   if(hp == NULL) return -1;
+   show("sendhb");
+   if(offset < 0 || offset % TRANLEN || offset > hp->size)
+      return send_map(np, hp->data, hp->size, offset, -1);  /* no crcs */
+   blocking(np->sd);   /* set blocking I/O for writev() */
+   return send_data(np, hp->data + offset, hp->size - offset,
+                    hp->crcs + offset / TRANLEN);
+}
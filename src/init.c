@@ -660,14 +660,15 @@ err:
 /* Get blocks that we need up to network Cblocknum */
 int get_eon(NODE *np, word32 peerip)
 {
-   FILE *fp, *tofp;           /* to "lock" and copy files */
-   pid_t gpid[MAXQUORUM];     /* Gang children */
+   FILE *fp, *tofp;           /* to copy files */
+   static PREFETCH pf;        /* block download from gang[] */
+   BTRAILER *tf;              /* trailers of tfile.dat after ngnum */
    word32 gang[MAXQUORUM];
    byte bnum[8], ngnum[8], highbnum[8];
-   byte dlbnum[8], clbnum[8];  /* download/clear block number */
+   byte tfbnum[8];            /* last block of tfile.dat */
    byte highhash[HASHLEN], *tfweight;
    byte highweight[HASHLEN];
-   int i, j, k, n, result;
+   int j, k, n, result;
    size_t cpbytes;            /* neo-gen transfer */
    char cpbuff[NGBUFFLEN];    /* neo-gen transfer */
    char fname[128], tofname[128];
@@ -677,9 +678,9 @@ int get_eon(NODE *np, word32 peerip)
    plog("Entering get_eon()");
 
    timeout = time(NULL) + 300;
+   tf = NULL;
 
 top:
-   memset(gpid, 0, sizeof(pid_t)*MAXQUORUM);
    memset(gang, 0, sizeof(gang));
    k = 0;
    tfweight = NULL;
@@ -730,6 +731,7 @@ top:
       if(result) goto try_again;  /* I/O error */
       if(cmp64(highbnum, bnum) > 0) goto try_again;
       if(cmp_weight(tfweight, highweight) < 0) goto try_again;
+      put64(tfbnum, bnum);
       break;  /* success */
    }
    if(!Running) resign("quorum tfile");
@@ -745,6 +747,10 @@ top:
    ngnum[0] = 0;
    if(sub64(ngnum, val256, ngnum)) memset(ngnum, 0, 8);
    if(Trace) plog("neo-genesis number: 0x%s", bnum2hex(ngnum));
+   /* keep the trailers to check the blocks by */
+   add64(ngnum, One, bnum);
+   tf = pf_readtf("tfile.dat", bnum, tfbnum);
+   if(tf == NULL) goto try_again;
    /* clean bc/ directory of block >= ngnum */
    delete_blocks(ngnum);
    /* trim the tfile back to the neo-genesis block and close the ledger */
@@ -816,83 +822,38 @@ top:
    }
 
    /* ****************
-    * Download the blockchain asynchronously using
-    * all accessible gang[] members.
+    * Download the blockchain from all gang[] members at once with
+    * pf_step(), each block checked against its trailer in tf[],
+    * and update() them in order as they come in.
     */
    show("dlblocks");
    printf("Downloading blockchain...\n");
-   put64(clbnum, bnum);
+   system("rm -f pf*.dat pf*.sig pf*.tmp");
    add64(bnum, One, bnum);
+   pf_init(&pf, tf, bnum, tfbnum, gang, Quorum, "pf");
    for( ; Running; ) {
-      put64(dlbnum, bnum);
-      /* i -> count children finished downloading
-       * j -> count peers discarded (get_block2() unsuccessful)
-       * k -> gang index
-       */
-      for(i=0, j=0, k=0, result=0; Running && k<Quorum; result=0) {
-         if(Monitor && Bgflag == 0) resign("user break 4");  /* DSL */
-         /* poll children */
-         if(gpid[k] > 0 && waitpid(gpid[k], &result, WNOHANG) > 0) {
-            if(result) gang[k] = 0;
-            gpid[k] = 0;
-            i++;
-         }
-         /* check peer ok */
-         peerip = gang[k];
-         if(peerip == 0) { j++; k++; continue; }
-         /* set block number to download */
-         sprintf(fname, "dblock%02X%02X.dat", dlbnum[1], dlbnum[0]);
-         sprintf(tofname, "rblock%02X%02X.dat", dlbnum[1], dlbnum[0]);
-         /* cleanup downloaded blocks from past sync attempts */
-         if(dlbnum[0] != 0 && cmp64(dlbnum, clbnum) > 0) {
-            put64(clbnum, dlbnum);
-            unlink(fname);
-            unlink(tofname);
-         }
-         /* check block duplicate */
-         if(dlbnum[0] == 0 || exists(tofname) || exists(fname)) {
-            add64(dlbnum, One, dlbnum);
-            continue;
-         }
-         /* spawn child to download block */
-         if(!gpid[k]) {
-            gpid[k] = fork();
-            if(gpid[k] > 0) add64(dlbnum, One, dlbnum); /* parent */
-            if(gpid[k] < 0) gang[k] = 0; /* parent */
-            if(gpid[k] == 0) { /* child */
-               fp = fopen(fname, "ab+"); /* get first dibs */
-               if(!fp) {
-                  error("init: cannot secure block file %s", fname);
-                  exit(VERROR);
-               } else fclose(fp);
-               result = get_block2(peerip, dlbnum, fname, OP_GETBLOCK);
-               if(result != VEOK) unlink(fname);
-               else if(rename(fname, tofname) != 0) {
-                  if(Trace) plog("init: cannot rename %s",fname);
-                  unlink(fname);
-                  exit(VERROR);
-               }
-               exit(result);
-            }
-         }
-         k++;
-      }  /* end for thread handling */
-      /* sleep cpu during no activity */
-      if(!i && Dynasleep) usleep(Dynasleep);
+      if(Monitor && Bgflag == 0) resign("user break 4");  /* DSL */
+      n = pf_step(&pf, Cblocknum);
+      if(n < 0) break;  /* unable to download more blockchain */
       /* update downloaded blocks (also constructs NG on 0xff blocks) */
-      sprintf(fname, "rblock%02X%02X.dat", bnum[1], bnum[0]);
-      while (exists(fname)) {
-         if(update(fname, 0) != VEOK) goto try_again;
-         add64(bnum, One, bnum);
+      for(j = 0; ; j++) {
+         add64(Cblocknum, One, bnum);
          if(bnum[0] == 0) add64(bnum, One, bnum);
-         sprintf(fname, "rblock%02X%02X.dat", bnum[1], bnum[0]);
-      }
-      /* unable to download more blockchain */
-      if(j>=Quorum) {
-         if(cmp64(bnum, highbnum) >= 0) break;
-         goto try_again;
+         if(!exists(pf_fname(&pf, fname, bnum, "dat"))) break;
+         rename(pf_fname(&pf, tofname, bnum, "sig"), "bsig.dat");
+         if(update(fname, 0) != VEOK) goto try_again;
+         unlink(fname);
       }
+      if(j == 0 && pf_done(&pf)) break;
+      /* sleep cpu during no activity */
+      if(n == 0 && j == 0 && Dynasleep) usleep(Dynasleep);
    }  /* end for block download-update */
+   pf_stop(&pf);
+   system("rm -f pf*.dat pf*.sig pf*.tmp");
+   free(tf);
+   tf = NULL;
+   if(!Running) resign("quorum update");
+   if(cmp64(Cblocknum, highbnum) < 0) goto try_again;
 #ifdef BX_MYSQL
    // Post-sync hook for database export
    if (Exportflag) {
@@ -900,7 +861,6 @@ top:
      system("../bx -e");
    }
 #endif
-   if(!Running) resign("quorum update");
 
    /* ****************
     * Re-compute Weight[].
@@ -921,6 +881,10 @@ top:
    return VEOK;
 
 try_again:
+   pf_stop(&pf);
+   system("rm -f pf*.dat pf*.sig pf*.tmp");
+   if(tf) free(tf);
+   tf = NULL;
    plog(":) (k: %d  Will restart in %d seconds.)", k,
         (int) (timeout - time(NULL)));
    if(Trace) {
@@ -955,6 +919,7 @@ int init(void)
 
    Running = 1;
    Ininit = 1;
+   busy_init();  /* OP_BUSY peers seen by get_eon() children */
 
    plog("Entering init()");
    show("init");
@@ -0,0 +1,103 @@
+/* inv.c  Inventory relay: announce tx_id's, send only wanted TX's
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * TX's gather in Mqring until server() starts the next mirror() --
+ * that cycle is the batch timer.  mirror1() then sends a peer with
+ * X_INV the tx_id's of up to INVLEN TX's in one OP_INV.  Its server()
+ * answers OP_INV_WANT with a byte for each tx_id, non-zero if Txcache[]
+ * has not seen it queued, and mirror1() sends only those as OP_TX on
+ * the same session.  Peers without X_INV get every TX as before.
+ *
+ * server() also keeps a set of the tx_id's each of the last INVPEERS
+ * peers sent or announced to us.  mirror() inherits it at fork(), and
+ * mirror_batch() leaves those TX's out for that peer altogether.
+ * A set holds the first word of INVKNOWN tx_id's, by the low bits of
+ * the second, so a new tx_id may push out an old one.
+*/
+
+
+#define INVLEN  (TRANLEN / HASHLEN)   /* tx_id's per OP_INV */
+
+typedef struct {
+   word32 ip;
+   time_t last;               /* time of the last inv_add() */
+   word32 known[INVKNOWN];    /* get32(tx_id), or zero */
+} INVPEER;
+
+INVPEER Invpeer[INVPEERS];
+word32 Ninvhave;   /* tx_id's in OP_INV we did not want */
+
+#define inv_slot(pp, tx_id) \
+   (&(pp)->known[get32((tx_id) + 4) & (INVKNOWN - 1)])
+
+
+/* Find the set of ip in Invpeer[].  If add is non-zero and ip is not
+ * there, the oldest set is given to ip.  Returns NULL if not found.
+ */
+INVPEER *inv_peer(word32 ip, int add)
+{
+   INVPEER *pp, *oldest;
+
+   for(oldest = pp = Invpeer; pp < &Invpeer[INVPEERS]; pp++) {
+      if(pp->ip == ip) return pp;
+      if(pp->last < oldest->last) oldest = pp;
+   }
+   if(!add) return NULL;
+   memset(oldest, 0, sizeof(INVPEER));
+   oldest->ip = ip;
+   return oldest;
+}  /* end inv_peer() */
+
+
+/* Note that ip has tx_id  -- in parent */
+void inv_add(word32 ip, byte *tx_id)
+{
+   INVPEER *pp;
+
+   if(ip == 0) return;
+   pp = inv_peer(ip, 1);
+   *inv_slot(pp, tx_id) = get32(tx_id);
+   pp->last = Ltime;
+}
+
+
+/* Return non-zero if ip is known to have tx_id. */
+int inv_known(word32 ip, byte *tx_id)
+{
+   INVPEER *pp;
+
+   pp = inv_peer(ip, 0);
+   if(pp == NULL) return 0;
+   return *inv_slot(pp, tx_id) == get32(tx_id);
+}
+
+
+/* Answer OP_INV in np with OP_INV_WANT  -- in parent from gettx()
+ * Returns VEOK or VERROR.
+ */
+int inv_recv(NODE *np)
+{
+   static byte want[INVLEN];
+   TXCENTRY *tc;
+   byte *id;
+   int j, count;
+
+   count = get16(np->tx.len) / HASHLEN;
+   if(count > INVLEN) count = INVLEN;
+   id = TRANBUFF(&np->tx);
+   for(j = 0; j < count; j++, id += HASHLEN) {
+      inv_add(np->src_ip, id);
+      tc = txcache_slot(id);
+      want[j] = tc->status != TXC_ACCEPT
+                || memcmp(tc->tx_id, id, HASHLEN) != 0;
+      if(!want[j]) Ninvhave++;
+   }
+   memset(TRANBUFF(&np->tx), 0, TRANLEN);
+   memcpy(TRANBUFF(&np->tx), want, count);
+   put16(np->tx.len, count);
+   return send_op(np, OP_INV_WANT);
+}  /* end inv_recv() */
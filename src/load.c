@@ -0,0 +1,136 @@
+/* load.c  Load governor: admission control for requests
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * Once a second server() calls load_update() to see how full each
+ * resource is, in percent of its limit:
+ *
+ *    forks   children in Nodes[] of MAXNODES - 5
+ *    queue   requests waiting in Hsnodes[] and the acceptor() rings
+ *    upload  bytes/sec sent by children of Bwrate (only with -B)
+ *    fds     lowest free descriptor of RLIMIT_NOFILE
+ *
+ * and keeps the highest in Load.  gettx() asks load_shed() before it
+ * serves a request.  OP_FOUND is always taken, block and tfile relay
+ * until Load reaches 100, TX mirroring until LOADTX, and queries until
+ * LOADQUERY.  A shed request gets OP_BUSY with the seconds to wait in
+ * the first two bytes of the transaction buffer.  acc_poll() asks it
+ * too for the OP_TX's in the acceptor() rings, which are just dropped.
+*/
+
+
+#include <limits.h>
+#include <sys/resource.h>
+
+int Load;                 /* highest of Loadpct[] */
+int Loadpct[4];           /* forks, queue, upload, fds */
+double Loadbytes;         /* bytes sent at the last load_update() */
+double Loadtime;
+
+
+/* Return the bytes sent by all children so far. */
+double load_sent(void)
+{
+   BWSLOT *bp;
+   double sent;
+
+   sent = Nkbsent * 1024.0;
+   if(Bwslot == NULL) return sent;
+   for(bp = Bwslot; bp < &Bwslot[MAXNODES]; bp++)
+      sent += bp->total;
+   return sent;
+}
+
+
+/* Sample the resources and set Load  -- in server() */
+void load_update(void)
+{
+   struct rlimit rl;
+   NODE *hp;
+   double now, sent;
+   int j, n, fd;
+
+   Loadpct[0] = Nonline * 100 / (MAXNODES - 5);
+
+   for(n = 0, hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++)
+      if(hp->state != HS_IDLE && hp->state != HS_SESS) n++;
+   Loadpct[1] = n * 100 / HSLEN;
+   for(j = 0; j < Acceptors; j++) {
+      n = (Accring[j].head - Accring[j].tail) * 100 / ACCQLEN;
+      if(n > Loadpct[1]) Loadpct[1] = n;
+   }
+
+   now = bw_now();
+   sent = load_sent();
+   Loadpct[2] = 0;
+   if(Bwrate && Loadtime && now > Loadtime && sent >= Loadbytes)
+      Loadpct[2] = (sent - Loadbytes) / (now - Loadtime) * 100 / Bwrate;
+   Loadbytes = sent;
+   Loadtime = now;
+
+   Loadpct[3] = 0;
+   fd = dup(0);  /* lowest free descriptor */
+   if(fd != -1) {
+      close(fd);
+      if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+         && rl.rlim_cur > 0) Loadpct[3] = fd * 100 / rl.rlim_cur;
+   }
+
+   for(Load = j = 0; j < 4; j++)
+      if(Loadpct[j] > Load) Load = Loadpct[j];
+}  /* end load_update() */
+
+
+/* Return the Load at which requests of opcode are shed. */
+int load_limit(int opcode)
+{
+   switch(opcode) {
+      case OP_FOUND:
+         return INT_MAX;  /* never */
+      case OP_GETBLOCK:
+      case OP_GET_TFILE:
+      case OP_TF:
+      case OP_HASH:
+      case OP_GET_CBLOCK:
+      case OP_MBLOCK:
+      case OP_SEND_BL:
+      case OP_GET_CMPCT:
+      case OP_GET_BLTX:
+         return 100;
+      case OP_TX:
+      case OP_GET_TXIDS:
+      case OP_GET_TXLIST:
+      case OP_INV:
+         return LOADTX;
+   }
+   return LOADQUERY;  /* OP_BALANCE, OP_RESOLVE, OP_GETIPL, ... */
+}  /* end load_limit() */
+
+
+/* Called by gettx() with a valid request in np, or by acc_poll()
+ * with a ring TX whose np->sd is INVALID_SOCKET.
+ * Returns 1 after an OP_BUSY reply if the request is shed, else 0.
+ */
+int load_shed(NODE *np)
+{
+   int load, limit, retry;
+
+   load = Nonline * 100 / (MAXNODES - 5);  /* forks since load_update() */
+   if(load < Load) load = Load;
+   limit = load_limit(np->opcode);
+   if(load < limit) return 0;
+   Nshed++;
+   retry = LOADRETRY * (1 + (load - limit) / 20);
+   if(Trace) plog("load_shed(): opcode %d at %d%%, retry in %d",
+                  np->opcode, load, retry);
+   if(np->sd == INVALID_SOCKET) return 1;  /* from an acceptor() ring */
+   memset(TRANBUFF(&np->tx), 0, TRANLEN);
+   put16(TRANBUFF(&np->tx), retry);
+   put16(np->tx.len, 2);
+   send_op(np, OP_BUSY);
+   return 1;
+}  /* end load_shed() */
+
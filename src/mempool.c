@@ -0,0 +1,451 @@
+/* mempool.c  Bound the pending TX queues, txq1.dat and txclean.dat
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * Every TXQENTRY is the same size, so fee-per-byte order is simply
+ * tx_fee order.  txq1.dat plus txclean.dat never hold more than Txqmax
+ * entries.  When they are full, a new TX must pay more than the
+ * cheapest TX in txq1.dat and is written over it.  txclean.dat is not
+ * touched, since bcon may be reading it.  txq_trim() evicts the
+ * cheapest entries of txclean.dat when the queues are merged for bcon.
+ * An evicted TX is dropped from Txcache[] too, so its src_addr can
+ * be sent again.
+*/
+
+
+word32 *Qfees;   /* malloc'd tx_fee[2] per record for txq_trim() */
+word32 *Q1fees;  /* malloc'd tx_fee[2] of each txq1.dat record */
+word32 Q1slot;   /* txq1.dat record for txq_put(), Txcount to append */
+
+/* sort record indexes by descending tx_fee */
+#define SHELLFUN (cmp64(&Qfees[a[k - *gap] * 2], &Qfees[temp * 2]) < 0)
+
+#include "sort.c"
+
+
+/* Return the number of TXQENTRY records in fname (0 if missing). */
+word32 txqcount(char *fname)
+{
+   FILE *fp;
+   long len;
+
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return 0;
+   fseek(fp, 0, SEEK_END);
+   len = ftell(fp);
+   fclose(fp);
+   if(len < 0) return 0;
+   return len / sizeof(TXQENTRY);
+}
+
+
+/* Called by process_tx() before tx_val().
+ * Sets Q1slot for txq_put().
+ * Returns VEOK to admit tx, else VERROR if the fee is below the
+ * relay fee or too low to displace anything in a full queue.
+ */
+int txq_admit(TX *tx)
+{
+   word32 j;
+
+   if(cmp64(tx->tx_fee, Relayfee) < 0) {
+      if(Trace) plog("txq_admit(): fee < relay fee %u", Relayfee[0]);
+      Nlowfee++;
+      return VERROR;
+   }
+   Q1slot = Txcount;
+   if(Txcount + Nclean < Txqmax) return VEOK;
+   /* Queues are full: find the cheapest TX in txq1.dat */
+   if(Q1fees) {
+      for(j = 0; j < Txcount; j++) {
+         if(Q1slot == Txcount
+            || cmp64(&Q1fees[j * 2], &Q1fees[Q1slot * 2]) < 0) Q1slot = j;
+      }
+   }
+   if(Q1slot == Txcount || cmp64(tx->tx_fee, &Q1fees[Q1slot * 2]) <= 0) {
+      if(Trace) plog("txq_admit(): queue full");
+      Nqfull++;
+      return VERROR;
+   }
+   return VEOK;
+}  /* end txq_admit() */
+
+
+/* Write tx and its tx_id to txq1.dat over record Q1slot from
+ * txq_admit(), or at the end if Q1slot is Txcount.
+ * Returns VEOK, or VERROR on I/O errors.
+ */
+int txq_put(TX *tx, byte *tx_id)
+{
+   static TXQENTRY old;
+   FILE *fp;
+   long offset;
+   int ecode;
+
+   if(Q1fees == NULL) {
+      Q1fees = malloc(Txqmax * 8);
+      if(Q1fees == NULL) return error("txq_put(): out of memory");
+   }
+   if(Q1slot < Txcount) {
+      offset = (long) Q1slot * sizeof(TXQENTRY);
+      fp = fopen("txq1.dat", "r+b");
+      if(fp == NULL) goto badopen;
+      if(fseek(fp, offset, SEEK_SET) != 0
+         || fread(&old, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY)
+         || fseek(fp, offset, SEEK_SET) != 0) {
+         fclose(fp);
+         return error("txq_put(): I/O error on txq1.dat");
+      }
+   } else {
+      Q1slot = Txcount;
+      fp = fopen("txq1.dat", "ab");
+      if(fp == NULL) goto badopen;
+   }
+   /* 3 addresses (TXADDRLEN*3) + 3 amounts (8*3) + signature (TXSIGLEN) */
+   ecode = 0;
+   if(fwrite(TRANBUFF(tx), 1, TRANLEN, fp) != TRANLEN) ecode = 1;
+   /* then source tx_id */
+   if(fwrite(tx_id, 1, HASHLEN, fp) != HASHLEN) ecode = 1;
+   if(fclose(fp) != 0) ecode = 1;
+   if(ecode) return error("bad write on txq1.dat");
+   put64(&Q1fees[Q1slot * 2], tx->tx_fee);
+   if(Q1slot < Txcount) {
+      txcache_drop(old.tx_id);  /* may come back with a higher fee */
+      Nevicted++;
+      if(Trace) plog("txq_put(): evicted record %u of txq1.dat", Q1slot);
+   } else {
+      Txcount++;
+      if(Trace) plog("incrementing Txcount to %d", Txcount);
+   }
+   return VEOK;
+badopen:
+   return error("txq_put(): Cannot open txq1.dat");
+}  /* end txq_put() */
+
+
+/* Keep the max highest fee records of fname in file order.
+ * Returns the number of records left in fname.
+ */
+word32 txq_trim(char *fname, word32 max)
+{
+   static TXQENTRY tx;
+   FILE *fp, *fpout;
+   word32 n, j, *idx;
+   byte *keep;
+
+   n = txqcount(fname);
+   if(n <= max) return n;
+
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return n;
+   Qfees = malloc(n * 8);
+   idx = malloc(n * sizeof(word32));
+   keep = calloc(n, 1);
+   if(Qfees == NULL || idx == NULL || keep == NULL) {
+      error("txq_trim(): out of memory");
+      goto out;
+   }
+   /* read each tx_fee[] */
+   for(j = 0; j < n; j++) {
+      if(fseek(fp, (long) j * sizeof(TXQENTRY)
+               + (TXADDRLEN*3) + (TXAMOUNT*2), SEEK_SET) != 0
+         || fread(&Qfees[j * 2], 1, TXAMOUNT, fp) != TXAMOUNT) {
+         error("txq_trim(): I/O error on %s", fname);
+         goto out;
+      }
+      idx[j] = j;
+   }
+   shell(idx, n);
+
+   /* evict the cheapest n - max records */
+   for(j = 0; j < max; j++) keep[idx[j]] = 1;
+   fpout = fopen("txqtrim.tmp", "wb");
+   if(fpout == NULL) {
+      error("txq_trim(): cannot write txqtrim.tmp");
+      goto out;
+   }
+   fseek(fp, 0, SEEK_SET);
+   for(j = 0; j < n; j++) {
+      if(fread(&tx, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY)) break;
+      if(!keep[j]) {
+         txcache_drop(tx.tx_id);  /* may come back with a higher fee */
+         continue;
+      }
+      if(fwrite(&tx, 1, sizeof(TXQENTRY), fpout) != sizeof(TXQENTRY)) break;
+   }
+   fclose(fpout);
+   fclose(fp);
+   fp = NULL;
+   if(j < n || rename("txqtrim.tmp", fname) != 0) {
+      error("txq_trim(): cannot rewrite %s", fname);
+      unlink("txqtrim.tmp");
+      goto out;
+   }
+   if(Trace) plog("txq_trim(): evicted %u of %u from %s", n - max, n, fname);
+   Nevicted += n - max;
+   n = max;
+out:
+   if(fp) fclose(fp);
+   if(Qfees) free(Qfees);
+   if(idx) free(idx);
+   if(keep) free(keep);
+   Qfees = NULL;
+   return n;
+}  /* end txq_trim() */
+
+
+/* Mempool sync: after start-up or catchup(), mpsync() asks a peer that
+ * advertises X_MPSYNC for the short id (first MPIDLEN bytes of tx_id)
+ * of every TX in its txclean.dat and txq1.dat with OP_GET_TXIDS, then
+ * fetches only the TX's we lack with OP_GET_TXLIST requests on the same
+ * socket, MPIDMAX id's per request.  Both replies are OP_SEND_BL file
+ * streams.  The parent feeds the fetched TX's in mpsync.dat through
+ * tx_in() a few at a time with mpsync_load().
+ */
+
+#define MPIDLEN  8
+#define MPIDMAX  (TRANLEN / MPIDLEN)  /* id's per OP_GET_TXLIST */
+
+typedef struct {
+   byte id[MPIDLEN];  /* first bytes of tx_id -- keep first */
+   word32 rec;        /* record number in file q */
+   byte q;            /* 0 = txclean.dat, 1 = txq1.dat */
+} MPIDX;
+
+long Mpsoffset;  /* mpsync_load() position in mpsync.dat */
+
+
+int mpid_cmp(const void *a, const void *b)
+{
+   return memcmp(a, b, MPIDLEN);
+}
+
+
+/* Build an index of the TX's in txclean.dat and txq1.dat sorted by id.
+ * If fp is not NULL, the queue files are left open in fp[0..1] for
+ * reading whole records (NULL if missing).
+ * Returns malloc'd index and sets *count, or NULL if none.
+ */
+MPIDX *mp_index(word32 *count, FILE **fp)
+{
+   static char *fname[2] = { "txclean.dat", "txq1.dat" };
+   FILE *fq;
+   MPIDX *idx;
+   word32 n, j, rec;
+   int q;
+
+   *count = 0;
+   if(fp) fp[0] = fp[1] = NULL;
+   n = txqcount(fname[0]) + txqcount(fname[1]);
+   if(n == 0) return NULL;
+   idx = malloc(n * sizeof(MPIDX));
+   if(idx == NULL) {
+      error("mp_index(): out of memory");
+      return NULL;
+   }
+   for(j = q = 0; q < 2; q++) {
+      fq = fopen(fname[q], "rb");
+      if(fq == NULL) continue;
+      for(rec = 0; j < n; rec++, j++) {
+         if(fseek(fq, (long) rec * sizeof(TXQENTRY) + TRANLEN, SEEK_SET) != 0
+            || fread(idx[j].id, 1, MPIDLEN, fq) != MPIDLEN) break;
+         idx[j].rec = rec;
+         idx[j].q = q;
+      }
+      if(fp) fp[q] = fq; else fclose(fq);
+   }
+   if(j == 0) { free(idx); return NULL; }
+   qsort(idx, j, sizeof(MPIDX), mpid_cmp);
+   *count = j;
+   return idx;
+}  /* end mp_index() */
+
+
+/* Answer OP_GET_TXIDS and the OP_GET_TXLIST requests that follow
+ * on np->sd until an empty request or timeout.
+ * Called from execute() in child.
+ * Returns VEOK, or VERROR on errors.
+ */
+int send_mempool(NODE *np)
+{
+   static TXQENTRY txq;
+   static byte want[MPIDMAX * MPIDLEN];
+   FILE *fp[2], *fpout;
+   MPIDX *idx, *ip;
+   word32 n, j, count;
+   char fname[32];
+   int status;
+
+   show("mpsync");
+   idx = mp_index(&n, fp);
+   sprintf(fname, "mp%u.tmp", (int) getpid());
+   status = VERROR;
+   if(np->opcode == OP_GET_TXIDS) {
+      fpout = fopen(fname, "wb");
+      if(fpout == NULL) goto out;
+      for(j = 0; j < n; j++) fwrite(idx[j].id, 1, MPIDLEN, fpout);
+      fclose(fpout);
+      if(send_file(np, fname) != VEOK) goto out;
+      nonblock(np->sd);  /* for rx2() */
+      if(rx2(np, 1, 10) != VEOK) { status = VEOK; goto out; }
+   }
+   for(;;) {
+      status = VEOK;
+      if(get16(np->tx.opcode) != OP_GET_TXLIST) break;
+      count = get16(np->tx.len) / MPIDLEN;
+      if(count == 0 || count > MPIDMAX) break;
+      memcpy(want, TRANBUFF(&np->tx), count * MPIDLEN);
+      status = VERROR;
+      fpout = fopen(fname, "wb");
+      if(fpout == NULL) break;
+      for(j = 0; j < count && n; j++) {
+         ip = bsearch(&want[j * MPIDLEN], idx, n, sizeof(MPIDX), mpid_cmp);
+         if(ip == NULL) continue;
+         if(fseek(fp[ip->q], (long) ip->rec * sizeof(TXQENTRY), SEEK_SET)
+            || fread(&txq, 1, sizeof(TXQENTRY), fp[ip->q])
+               != sizeof(TXQENTRY)) continue;
+         fwrite(&txq, 1, sizeof(TXQENTRY), fpout);
+      }
+      fclose(fpout);
+      if(send_file(np, fname) != VEOK) break;
+      nonblock(np->sd);
+      status = VEOK;
+      if(rx2(np, 1, 10) != VEOK) break;
+   }  /* end for OP_GET_TXLIST */
+out:
+   unlink(fname);
+   if(idx) free(idx);
+   if(fp[0]) fclose(fp[0]);
+   if(fp[1]) fclose(fp[1]);
+   return status;
+}  /* end send_mempool() */
+
+
+/* Fetch the TX's that our queues lack from ip into mpsync.dat.
+ * Called by mpsync() in child.
+ * Returns VEOK on success, else VERROR.
+ */
+int mpsync_peer(word32 ip)
+{
+   NODE node;
+   FILE *fp;
+   MPIDX *idx;
+   byte id[MPIDLEN];
+   word32 n, count, total;
+   int status;
+
+   if(callserver(&node, ip) != VEOK) return VERROR;
+   if((node.xcaps & X_MPSYNC) == 0) {
+      closesocket(node.sd);
+      return VERROR;
+   }
+   if(Trace) plog("mpsync_peer(%s)", ntoa((byte *) &ip));
+   if(send_op(&node, OP_GET_TXIDS) != VEOK
+      || get_block3(&node, "mpids.tmp") != 0
+      || (fp = fopen("mpids.tmp", "rb")) == NULL) {
+         closesocket(node.sd);
+         return VERROR;
+   }
+   idx = mp_index(&n, NULL);
+   status = VEOK;
+   for(count = total = 0; ; ) {
+      if(total < Txqmax && fread(id, 1, MPIDLEN, fp) == MPIDLEN) {
+         if(n && bsearch(id, idx, n, sizeof(MPIDX), mpid_cmp)) continue;
+         memcpy(TRANBUFF(&node.tx) + count * MPIDLEN, id, MPIDLEN);
+         total++;
+         if(++count < MPIDMAX) continue;
+      }
+      if(count == 0) break;
+      put16(node.tx.len, count * MPIDLEN);
+      if(send_op(&node, OP_GET_TXLIST) != VEOK
+         || get_block3(&node, "mptx.tmp") != 0
+         || fappend("mptx.tmp", "mpsync.dat", sizeof(TXQENTRY)) != VEOK) {
+            status = VERROR;
+            break;
+      }
+      count = 0;
+   }  /* end for */
+   fclose(fp);
+   unlink("mpids.tmp");
+   if(idx) free(idx);
+   closesocket(node.sd);
+   if(Trace) plog("mpsync_peer(): wanted %u TX's", total);
+   if(status == VEOK) write_data(&ip, 4, "mpsync.lst");
+   return status;
+}  /* end mpsync_peer() */
+
+
+/* Fill mpsync.dat from the first recent peer that can.
+ * Called from server()       --  becomes child
+ */
+pid_t mpsync(void)
+{
+   pid_t pid;
+   word32 list[RPLISTLEN];
+   int j;
+
+   pid = fork();
+   if(pid < 0) {
+      error("mpsync(): Cannot fork()");
+      return 0;
+   }
+   if(pid) return pid;  /* to parent */
+
+   /* in child */
+   show("mpsync");
+   unlink("mpsync.dat");
+   memcpy(list, Rplist, sizeof(list));
+   shuffle32(list, RPLISTLEN);
+   for(j = 0; j < RPLISTLEN && Running; j++) {
+      if(list[j] == 0) continue;
+      if(mpsync_peer(list[j]) == VEOK) exit(0);
+      unlink("mpsync.dat");
+   }
+   exit(1);
+}  /* end mpsync() */
+
+
+/* Feed up to max TX's from mpsync.dat through tx_in()  -- in parent
+ * Returns 1 while more remain, else 0 after removing mpsync.dat.
+ */
+int mpsync_load(word32 max)
+{
+   static TXQENTRY txq;
+   static NODE node;
+   FILE *fp;
+   word32 ip;
+   int status;
+
+   if(read_data(&ip, 4, "mpsync.lst") != 4) ip = 0;
+   fp = fopen("mpsync.dat", "rb");
+   if(fp == NULL) goto done;
+   if(fseek(fp, Mpsoffset, SEEK_SET) != 0) goto done;
+   for( ; max; max--) {
+      if(fread(&txq, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY))
+         goto done;
+      memset(&node, 0, sizeof(NODE));
+      node.src_ip = ip;
+      memcpy(TRANBUFF(&node.tx), &txq, TRANLEN);
+      /* A full ip map keeps txmap() from mirroring them again. */
+      memset(node.tx.weight, 0xff, HASHLEN);
+      status = tx_in(&node);
+      if(status == 0) Nmpsync++;
+      if(status > 1) {
+         if(Trace) plog("mpsync_load(): bad TX from %s", ntoa((byte *) &ip));
+         if(ip) pinklist(ip);
+         goto done;
+      }
+   }
+   Mpsoffset = ftell(fp);
+   fclose(fp);
+   return 1;
+done:
+   if(fp) fclose(fp);
+   unlink("mpsync.dat");
+   unlink("mpsync.lst");
+   Mpsoffset = 0;
+   return 0;
+}  /* end mpsync_load() */
@@ -23,13 +23,23 @@
 #include "sock.c"       /* inet utilities */
 #include "pink.c"       /* manage pinklist                 */
 #include "connect.c"    /* make outgoing connection        */
+#include "bstream.c"    /* check blocks as they come in    */
 #include "call.c"       /* callserver() and friends        */
 #include "ledger.c"
 #include "tag.c"        /* address tag support             */
+#include "txcache.c"    /* recent tx_id cache              */
+#include "inv.c"        /* OP_INV announce and want-lists  */
+#include "mempool.c"    /* bound txq1.dat and txclean.dat  */
 #include "gettx.c"      /* poll and read NODE socket       */
 #include "txval.c"      /* validate transactions           */
+#include "mqring.c"     /* mirror queue in shared memory    */
 #include "mirror.c"
+#include "bwlimit.c"    /* upload limits for send_data()   */
 #include "execute.c"
+#include "acceptor.c"   /* -aN handshake processes          */
+#include "hotblock.c"   /* recent blocks for OP_GETBLOCK    */
+#include "load.c"       /* OP_BUSY load shedding            */
+#include "compact.c"    /* compact block relay              */
 #include "phost.c"      /* utility to print host info      */
 #include "monitor.c"    /* system monitor/debugger prompt  */
 #include "daemon.c"
@@ -40,7 +50,10 @@
 #include "optf.c"       /* for OP_HASH and OP_TF           */
 #include "proof.c"
 #include "renew.c"
+#include "found.c"      /* send_found() to all peers at once */
 #include "update.c"
+#include "prefetch.c"   /* blocks from several peers at once */
+#include "catchup.c"    /* catchup() in the background     */
 #include "init.c"       /* read Coreplist[] and get_eon()  */
 #include "server.c"     /* tcp server */
 int main(void)
@@ -34,65 +34,210 @@ int txmap(TX *tx, word32 src_ip)
 }  /* end txmap() */
 
 
-/* Create a grandchild to send TX's in mirror.dat to ip... */
-pid_t mgc(word32 ip)
-{
-   pid_t pid;
-   FILE *fp;
-   long offset;
-   int lockfd, count;
-   TX mtx;
+/* The mirror engine: mirror1() sends the TX's of Mqring to all
+ * peers on iplist from one child over non-blocking sockets and poll().
+ * They are copied and hashed once, and each peer keeps its own
+ * place in them.  A peer with X_INV gets batches of up to INVLEN tx_id's
+ * in OP_INV and then the TX's it wants -- see inv.c.  A peer with
+ * X_SESSION gets them all on one connection, others on one each.
+ */
+
+#define MS_IDLE     0
+#define MS_CONNECT  1   /* waiting for connect() */
+#define MS_ACK      2   /* waiting for OP_HELLO_ACK */
+#define MS_WANT     3   /* waiting for OP_INV_WANT */
+#define MS_SEND     4   /* sending the wanted TX's of the batch */
+#define MS_DONE     5
+
+typedef struct {
    NODE node;
+   int state;
+   int tries;            /* failed connections */
+   word32 next;          /* next record of Mtx[] to batch */
+   int n, j;             /* records in batch, and next to send */
+   word32 rec[INVLEN];   /* the batch */
+   byte want[INVLEN];
+   time_t deadline;
+} MPEER;
 
-   /* create grandchild */
-   pid = fork();
-   if(pid < 0) {
-      error("mgc(): Cannot fork()");
-      return 0;  /* to parent */
-   }
-   if(pid) return pid;  /* to parent */
+TX *Mtx;          /* TX's of this mirror() from Mqring */
+byte *Mids;       /* tx_id's of Mtx[] */
+word32 Mcount;    /* records in Mtx[] */
+word32 Msent;     /* OP_TX's sent by mirror1() */
 
-   /* in (grand) child */
-   if(Trace) plog("mgc()...");
-   show("mgc()");
 
-   fp = fopen("mirror.dat", "rb");
-   if(fp == NULL) {
-      error("mgc(): Cannot open mirror.dat");
-      exit(1);
-   }
-   offset = 0;
+/* Fill the next batch of mp with the records of Mtx[] not known to
+ * its peer.  Returns the count.
+ */
+int mirror_batch(MPEER *mp)
+{
+   word32 ip;
 
-   while(Running) {
-      lockfd = lock("mq.lck", 20);
-      if(lockfd == -1) {
-         error("mgc(): Cannot lock mq.lck"); fclose(fp); exit(1);
-      }
-      if(fseek(fp, offset, SEEK_SET)) {
-         unlock(lockfd); fclose(fp); exit(1);
-      }
-      /* read the TX from mirror.dat */
-      count = fread(&mtx, 1, sizeof(TX), fp);
-      /* preserve seek pos because other mgc()'s may be running */
-      offset = ftell(fp);
-      unlock(lockfd);
-      if(count != sizeof(TX)) break;
+   ip = mp->node.src_ip;
+   for(mp->n = mp->j = 0; mp->n < INVLEN && mp->next < Mcount; mp->next++) {
       /* if not in -v modes... */
       if(Port == Dstport) {
          /* Skip this TX if ip address is already in map. */
-         if(search32(ip, (word32 *) mtx.weight, 8)) continue;
+         if(search32(ip, (word32 *) Mtx[mp->next].weight, 8)) continue;
       }
-      if(callserver(&node, ip) != VEOK) break;
-      put16(node.tx.len, 0);  /* signal not wallet to peer */
-      memcpy(TRANBUFF(&node.tx), TRANBUFF(&mtx), TRANLEN);
-      /* copy ip address map to outgoing TX */
-      memcpy(node.tx.weight, mtx.weight, 32);
-      send_op(&node, OP_TX);
-      closesocket(node.sd);
-   }  /* end while Running */
-   fclose(fp);
-   exit(0);
-}  /* end mgc() */
+      if(inv_known(ip, &Mids[mp->next * HASHLEN])) continue;  /* ip sent it */
+      mp->want[mp->n] = 1;
+      mp->rec[mp->n++] = mp->next;
+   }
+   return mp->n;
+}  /* end mirror_batch() */
+
+
+/* Start a connection to the peer of mp, or give up on it if it is
+ * out of tries or has asked us to wait with OP_BUSY.
+ */
+void mirror_connect(MPEER *mp)
+{
+   SOCKET sd;
+   word32 ip;
+
+   mp->state = MS_DONE;
+   if(mp->tries >= 2 || !Running || busy_peer(mp->node.src_ip)) return;
+   sd = connect_nb(mp->node.src_ip);
+   if(sd == INVALID_SOCKET) {
+      mp->tries++;
+      return;
+   }
+   ip = mp->node.src_ip;
+   memset(&mp->node, 0, sizeof(NODE));  /* new handshake */
+   mp->node.sd = sd;
+   mp->node.src_ip = ip;
+   mp->state = MS_CONNECT;
+   mp->deadline = time(NULL) + ACK_TIMEOUT;
+}  /* end mirror_connect() */
+
+
+/* Close the connection of mp.  Reconnect if its batch is not done. */
+void mirror_close(MPEER *mp, int ok)
+{
+   closesocket(mp->node.sd);
+   if(!ok) mp->tries++;
+   if(mp->j < mp->n || mirror_batch(mp)) mirror_connect(mp);
+   else mp->state = MS_DONE;
+}
+
+
+/* Send OP_INV of the batch of mp, or go on to the TX's. */
+void mirror_inv(MPEER *mp)
+{
+   NODE *np;
+   int j;
+
+   np = &mp->node;
+   if((np->xcaps & Xcaps & X_INV) == 0 || mp->j) {
+      mp->state = MS_SEND;
+      return;
+   }
+   memset(TRANBUFF(&np->tx), 0, TRANLEN);
+   for(j = 0; j < mp->n; j++)
+      memcpy(TRANBUFF(&np->tx) + j * HASHLEN, &Mids[mp->rec[j] * HASHLEN],
+             HASHLEN);
+   put16(np->tx.len, mp->n * HASHLEN);
+   if(send_op(np, OP_INV) != VEOK) {
+      mirror_close(mp, 0);
+      return;
+   }
+   mp->state = MS_WANT;
+}  /* end mirror_inv() */
+
+
+/* Step mp after poll() says it is ready. */
+void mirror_step(MPEER *mp)
+{
+   NODE *np;
+   int err, status;
+   socklen_t len;
+
+   np = &mp->node;
+   mp->deadline = time(NULL) + ACK_TIMEOUT;
+   switch(mp->state) {
+      case MS_CONNECT:
+         len = sizeof(err);
+         if(getsockopt(np->sd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            || err != 0) break;
+         np->id1 = rand16();
+         if(send_op(np, OP_HELLO) != VEOK) break;
+         mp->state = MS_ACK;
+         return;
+      case MS_ACK:
+      case MS_WANT:
+         status = rx_step(np);
+         if(status == -1) return;  /* not all here yet */
+         if(status != VEOK
+            || rxcheck(np, mp->state == MS_WANT) != VEOK) break;
+         if(get16(np->tx.opcode) == OP_BUSY) {
+            busy_check(np);
+            mp->tries = 2;  /* leave it be */
+            break;
+         }
+         if(mp->state == MS_ACK) {
+            if(get16(np->tx.opcode) != OP_HELLO_ACK
+               || get16(np->tx.id1) != np->id1) break;
+            np->id2 = get16(np->tx.id2);
+            np->caps = np->tx.version[1];
+            np->xcaps = get_xcaps(&np->tx);
+            mirror_inv(mp);
+            return;
+         }
+         if(get16(np->tx.opcode) != OP_INV_WANT
+            || get16(np->tx.len) != mp->n) break;
+         memcpy(mp->want, TRANBUFF(&np->tx), mp->n);
+         mp->state = MS_SEND;
+         return;
+      case MS_SEND:
+         while(mp->j < mp->n && !mp->want[mp->j]) mp->j++;
+         if(mp->j < mp->n) {
+            put16(np->tx.len, 0);  /* signal not wallet to peer */
+            memcpy(TRANBUFF(&np->tx), TRANBUFF(&Mtx[mp->rec[mp->j]]),
+                   TRANLEN);
+            /* copy ip address map to outgoing TX */
+            memcpy(np->tx.weight, Mtx[mp->rec[mp->j]].weight, 32);
+            if(send_op(np, OP_TX) != VEOK) break;
+            mp->j++;
+            Msent++;
+            if((np->xcaps & Xcaps & X_SESSION) == 0) {
+               mirror_close(mp, 1);  /* one TX per connection */
+               return;
+            }
+         }
+         while(mp->j < mp->n && !mp->want[mp->j]) mp->j++;
+         if(mp->j < mp->n) return;
+         if(mirror_batch(mp) == 0) {
+            closesocket(np->sd);
+            mp->state = MS_DONE;
+            return;
+         }
+         mirror_inv(mp);
+         return;
+   }  /* end switch */
+   mirror_close(mp, 0);
+}  /* end mirror_step() */
+
+
+/* Copy records Mqtail to Mqend of Mqring and hash their tx_id's.
+ * Returns VEOK or VERROR.
+ */
+int mirror_load(void)
+{
+   word32 rec, n;
+
+   n = Mqend - Mqtail;
+   if(n == 0 || n > MQLEN || Mqring == NULL) return VERROR;
+   Mtx = malloc(n * sizeof(TX));
+   Mids = malloc(n * HASHLEN);
+   if(Mtx == NULL || Mids == NULL) return error("mirror(): out of memory");
+   for(Mcount = 0, rec = Mqtail; rec != Mqend; rec++) {
+      if(mq_get(rec, &Mtx[Mcount]) != VEOK) continue;  /* overwritten */
+      sha256(Mtx[Mcount].src_addr, TXADDRLEN, &Mids[Mcount * HASHLEN]);
+      Mcount++;
+   }
+   return VEOK;
+}  /* end mirror_load() */
 
 
 #if CPLISTLEN > RPLISTLEN
@@ -104,9 +249,12 @@ error fix CPLISTLEN: It must be <= RPLISTLEN
  */
 pid_t mirror1(word32 *iplist, int len)
 {
-   pid_t pid, peer[RPLISTLEN];
-   int j;
-   byte busy;
+   static MPEER peer[RPLISTLEN + LPLISTLEN];
+   struct pollfd pfd[RPLISTLEN + LPLISTLEN];
+   MPEER *mp, *ready[RPLISTLEN + LPLISTLEN];
+   pid_t pid;
+   time_t now;
+   int j, k, n, nfds;
 
    /* create child */
    pid = fork();
@@ -119,31 +267,43 @@ pid_t mirror1(word32 *iplist, int len)
    /* in child */
    if(Trace) plog("mirror()...");
    show("mirror");
+   if(mirror_load() != VEOK) exit(1);
 
    shuffle32(iplist, len);  /* NOTE: can create embedded zeros. */
-   /* Create up to len mgc() grandchildren */
-   for(j = 0; j < len; j++) {
-      if(iplist[j] == 0) { peer[j] = 0; continue; }
-      peer[j] = mgc(iplist[j]);  /* grandchild */
+   for(n = j = 0; j < len; j++) {
+      if(iplist[j] == 0) continue;
+      for(k = 0; k < n; k++) if(peer[k].node.src_ip == iplist[j]) break;
+      if(k < n) continue;  /* in both lists */
+      mp = &peer[n++];
+      memset(mp, 0, sizeof(MPEER));
+      mp->node.src_ip = iplist[j];
+      if(mirror_batch(mp)) mirror_connect(mp);
+      else mp->state = MS_DONE;
    }
 
-   /* while Running, wait for grandchildren to finish. */
    while(Running) {
-      busy = FALSE;
-      for(j = 0; j < len; j++) {
-         if(peer[j] == 0) continue;
-         pid = waitpid(peer[j], NULL, WNOHANG);
-         if(pid <= 0) busy = 1; else peer[j] = 0;
+      now = time(NULL);
+      for(nfds = 0, mp = peer; mp < &peer[n]; mp++) {
+         if(mp->state == MS_DONE) continue;
+         if(now >= mp->deadline) {
+            if(Trace) plog("mirror(): %s timed out",
+                           ntoa((byte *) &mp->node.src_ip));
+            mirror_close(mp, 0);
+            if(mp->state == MS_DONE) continue;
+         }
+         pfd[nfds].fd = mp->node.sd;
+         pfd[nfds].events = (mp->state == MS_CONNECT
+                             || mp->state == MS_SEND) ? POLLOUT : POLLIN;
+         ready[nfds++] = mp;
       }
-      if(!busy) exit(0);
+      if(nfds == 0) break;  /* all done */
+      if(poll(pfd, nfds, 100) <= 0) continue;
+      for(j = 0; j < nfds; j++)
+         if(pfd[j].revents) mirror_step(ready[j]);
    }  /* end while Running */
-   /* got SIGTERM */
-   for(j = 0; j < len; j++) {
-      if(peer[j]) {
-         kill(peer[j], SIGTERM);     /* Kill grandchild */
-         waitpid(peer[j], NULL, 0);  /* and burry her. */
-      }
-   }
+   for(mp = peer; mp < &peer[n]; mp++)
+      if(mp->state != MS_DONE) closesocket(mp->node.sd);  /* SIGTERM */
+   if(Trace) plog("mirror(): %u TX's to %d peers", Msent, n);
    exit(0);
 }  /* end mirror1() */
 
@@ -193,23 +353,22 @@ void stop_mirror(void)
 /* Called by gettx()  -- in parent
  *
  * Validate a TX, write clean TX to txq1.dat, and raw TX to
- * mirror queue, mq.dat.
- * Locks mq.lck while appending mq.dat.
+ * mirror queue, Mqring.
  */
 int process_tx(NODE *np)
 {
    TX *tx;
    int evilness;
-   int count, lockfd;
-   int ecode;
    byte tx_id[HASHLEN];
-   FILE *fp;
 
    if(Trace) plog("process_tx()");
    show("tx");
 
    tx = &np->tx;
 
+   /* Relay fee and queue size policy before the expensive checks. */
+   if(txq_admit(tx) != VEOK) return 1;
+
    /* Validate addresses, fee, signature, source balance, and total. */
    evilness = tx_val(tx);
    if(evilness) return evilness;
@@ -217,56 +376,13 @@ int process_tx(NODE *np)
    /* Compute tx_id[] (hash of tx->src_addr) to append to txq1.dat. */
    sha256(tx->src_addr, TXADDRLEN, tx_id);
 
-   fp = fopen("txq1.dat", "ab");
-   if(!fp) {
-      error("process_tx(): Cannot open txq1.dat");
-      return 1;
-   }
-
    /* Now write transaction to txq1.dat followed by tx_id */
-   ecode = 0;
-   /* 3 addresses (TXADDRLEN*3) + 3 amounts (8*3) + signature (TXSIGLEN) */
-   count = fwrite(TRANBUFF(tx), 1, TRANLEN, fp);
-   if(count != TRANLEN) ecode = 1;
-   /* then append source tx_id */
-   count = fwrite(tx_id, 1, HASHLEN, fp);
-   if(count != HASHLEN) ecode = 1;
-   if(Trace) plog("writing TX to txq1.dat");
-   fclose(fp);  /* close txq1.dat */
-   if(ecode) {
-      error("bad write on txq1.dat");
-      return 1;
-   }
-   else {
-      Txcount++;
-      if(Trace) plog("incrementing Txcount to %d", Txcount);
-   }
+   if(txq_put(tx, tx_id) != VEOK) return 1;
    Nrec++;  /* total good TX received */
 
-   /* lock mirror file */
-   lockfd = lock("mq.lck", 20);
-   if(lockfd == -1) {
-      error("process_tx(): Cannot lock mq.lck");  /* should not happen */
-      return 1;
-   }
-   fp = fopen("mq.dat", "ab");
-   if(!fp) {
-      error("process_tx(): Cannot open mq.dat");
-      unlock(lockfd);
-      return 1;
-   }
-   ecode = 0;
    /* If empty slot in mirror address map, fill it
-    * in and then write tx to mirror queue, mq.dat.
+    * in and then put tx in mirror queue, Mqring.
     */
-   if(txmap(tx, np->src_ip) == VEOK) {
-      count = fwrite(tx, 1, sizeof(TX), fp);
-      if(count != sizeof(TX)) {
-         error("bad write on mq.dat");
-         ecode = 1;
-      } else Mqcount++;
-   }
-   fclose(fp);      /* close mirror queue, mq.dat */
-   unlock(lockfd);  /* unlock mirror queue lock, mq.lck */
-   return ecode;
+   if(txmap(tx, np->src_ip) == VEOK) mq_put(tx);
+   return 0;
 }  /* end process_tx() */
@@ -34,13 +34,23 @@
 #include "sock.c"       /* inet utilities */
 #include "pink.c"       /* manage pinklist                 */
 #include "connect.c"    /* make outgoing connection        */
+#include "bstream.c"    /* check blocks as they come in    */
 #include "call.c"       /* callserver() and friends        */
 #include "ledger.c"
 #include "tag.c"        /* address tag support             */
+#include "txcache.c"    /* recent tx_id cache              */
+#include "inv.c"        /* OP_INV announce and want-lists  */
+#include "mempool.c"    /* bound txq1.dat and txclean.dat  */
 #include "gettx.c"      /* poll and read NODE socket       */
 #include "txval.c"      /* validate transactions           */
+#include "mqring.c"     /* mirror queue in shared memory    */
 #include "mirror.c"
+#include "bwlimit.c"    /* upload limits for send_data()   */
 #include "execute.c"
+#include "acceptor.c"   /* -aN handshake processes          */
+#include "hotblock.c"   /* recent blocks for OP_GETBLOCK    */
+#include "load.c"       /* OP_BUSY load shedding            */
+#include "compact.c"    /* compact block relay              */
 #include "phost.c"      /* utility to print host info      */
 #include "monitor.c"    /* system monitor/debugger prompt  */
 #include "daemon.c"
@@ -51,7 +61,10 @@
 #include "optf.c"       /* for OP_HASH and OP_TF           */
 #include "proof.c"
 #include "renew.c"
+#include "found.c"      /* send_found() to all peers at once */
 #include "update.c"
+#include "prefetch.c"   /* blocks from several peers at once */
+#include "catchup.c"    /* catchup() in the background     */
 #include "init.c"       /* read Coreplist[] and get_eon()  */
 #include "server.c"     /* tcp server                      */
 
@@ -79,6 +92,12 @@ void usage(void)
           "         -P         Allow pushed mblocks\n"
           "         -n         Do not solve blocks\n"
           "         -Mn        set transaction fee to n\n"
+          "         -Rn        set minimum relay fee to n\n"
+          "         -Qn        queue at most n pending TX's\n"
+          "         -Bn[,m]    limit uploads to n KB/s, m KB/s per peer\n"
+          "         -Ob[,t,f]  limit each block, tfile and OP_TF upload\n"
+          "                    to b, t and f KB/s\n"
+          "         -aN        run N acceptor processes on the port\n"
           "         -Sanctuary=N,Lastday\n"
           "         -uUSER     set username to USER, no password\n"
    );
@@ -106,7 +125,7 @@ void veronica(void)
 
 int main(int argc, char **argv)
 {
-   static int j;
+   static int j, k;
    static byte endian[] = { 0x34, 0x12 };
    static char *cp;
    
@@ -127,6 +146,7 @@ int main(int argc, char **argv)
    srand2(Ltime ^ get32(Maddr+4), 0, 123456789 ^ get32(Maddr+8) ^ getpid());
 
    Port = Dstport = PORT1;    /* default receive port */
+   Cbits |= C_VARLEN;         /* compact frames -- see sendtxv() */
    /*
     * Parse command line arguments.
     */
@@ -187,6 +207,23 @@ int main(int argc, char **argv)
                     if(Myfee[0] < Mfee[0]) Myfee[0] = Mfee[0];
                     else Cbits |= C_MFEE;
                     break;
+         case 'R':  Relayfee[0] = atoi(&argv[j][2]);
+                    if(Relayfee[0] < Mfee[0]) Relayfee[0] = Mfee[0];
+                    break;
+         case 'B':  Bwrate = strtoul(&argv[j][2], NULL, 0) * 1024;
+                    cp = strchr(argv[j], ',');
+                    if(cp) Bwpeer = strtoul(cp + 1, NULL, 0) * 1024;
+                    break;
+         case 'O':  cp = &argv[j][1];
+                    for(k = 0; cp && k < 3; k++, cp = strchr(cp + 1, ','))
+                       Bwop[k] = strtoul(cp + 1, NULL, 0) * 1024;
+                    break;
+         case 'a':  Acceptors = atoi(&argv[j][2]);
+                    if((unsigned) Acceptors > MAXACCEPT) usage();
+                    break;
+         case 'Q':  Txqmax = atoi(&argv[j][2]);
+                    if(Txqmax < TXQUEBIG) usage();
+                    break;
          case 'u':  if(argv[j][2]) {
                        cp = &argv[j][2];
                        sha256_init(&ictx);
@@ -41,16 +41,32 @@ int stats(int showflag)
                "   TX recvd:        %u\n"
                "   Balances sent:   %u\n"
                "   TX dups:         %u\n"
+               "   TX cache hits:   %u/%u\n"
                "   txq1 count:      %u\n"
+               "   Mempool:         %u TX's  %lu bytes\n"
+               "   TX evicted:      %u\n"
+               "   TX queue full:   %u\n"
+               "   TX low fee:      %u\n"
+               "   TX mpsync:       %u\n"
+               "   TX inv. had:     %u\n"
+               "   TX mirror lost:  %u\n"
+               "   Acceptor lost:   %u\n"
+               "   Rate limited:    %u\n"
+               "   Load shed:       %u  (load %d%%)\n"
                "   Sends blocked:   %u\n"
                "   Blocks solved:   %u\n"
                "   Blocks updated:  %u\n"
                "\n",
                 Eon, Ngen,
                 Nonline, Nlogins, Nbadlogs, Nspace, Ntimeouts,
-                Nerrors, Nrec, Nsent, Ndups, Txcount, Nsenderr,
-                Nsolved, Nupdated
+                Nerrors, Nrec, Nsent, Ndups, Ntxhits, Ntxprobes, Txcount,
+                Txcount + Nclean,
+                (unsigned long) (Txcount + Nclean) * sizeof(TXQENTRY),
+                Nevicted, Nqfull, Nlowfee, Nmpsync, Ninvhave, Mqlost, Nacclost,
+                Nthrottled, Nshed, Load,
+                Nsenderr, Nsolved, Nupdated
    );
+   bw_stats();
 
    printf("Current block: 0x%s\n", bnum2hex(Cblocknum));
    printf("Weight:        0x...%s\n"
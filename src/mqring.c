@@ -0,0 +1,97 @@
+/* mqring.c  Mirror queue: TX's for mirror() in shared memory
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * process_tx() in server() puts each TX to mirror in Mqring, mapped by
+ * mq_init() before any fork(), in place of mq.dat and mq.lck.  There is
+ * one writer, so head needs no lock.  Each entry has the record number
+ * plus one in seq while it holds a whole TX and zero while it is being
+ * written, and mq_get() checks seq before and after its copy, so any
+ * number of readers can copy records out without holding anything.
+ * A reader that falls MQLEN records behind loses the oldest ones.
+ *
+ * server() hands records Mqtail to Mqend to each mirror() child and
+ * moves Mqtail up when the child is reaped, however it ended.
+*/
+
+
+typedef struct {
+   volatile word32 seq;   /* record number + 1, or 0 while written */
+   TX tx;
+} MQENTRY;
+
+typedef struct {
+   volatile word32 head;  /* records put so far -- written by server() */
+   MQENTRY ent[MQLEN];
+} MQRING;
+
+MQRING *Mqring;   /* shared with children */
+word32 Mqtail;    /* first record not yet mirrored */
+word32 Mqend;     /* records up to here go to the mirror() child */
+word32 Mqlost;    /* records overwritten before mirror() took them */
+
+
+/* Map Mqring before server() forks any children.
+ * Returns VEOK, or VERROR if TX's cannot be mirrored.
+ */
+int mq_init(void)
+{
+   Mqring = mmap(NULL, sizeof(MQRING), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(Mqring == MAP_FAILED) {
+      Mqring = NULL;
+      return error("mq_init(): cannot mmap() Mqring");
+   }
+   Mqtail = Mqend = 0;
+   return VEOK;
+}  /* end mq_init() */
+
+
+/* Put tx at the head of Mqring  -- in server() only */
+void mq_put(TX *tx)
+{
+   MQENTRY *ep;
+   word32 head;
+
+   if(Mqring == NULL) return;
+   head = Mqring->head;
+   ep = &Mqring->ent[head % MQLEN];
+   ep->seq = 0;
+   __sync_synchronize();  /* seq before TX */
+   memcpy(&ep->tx, tx, sizeof(TX));
+   __sync_synchronize();  /* TX before seq */
+   ep->seq = head + 1;
+   Mqring->head = head + 1;
+}  /* end mq_put() */
+
+
+/* Copy record rec of Mqring to tx.
+ * Returns VEOK, or VERROR if it was overwritten.
+ */
+int mq_get(word32 rec, TX *tx)
+{
+   MQENTRY *ep;
+
+   ep = &Mqring->ent[rec % MQLEN];
+   if(ep->seq != rec + 1) return VERROR;
+   __sync_synchronize();  /* seq before TX */
+   memcpy(tx, &ep->tx, sizeof(TX));
+   __sync_synchronize();  /* TX before seq again */
+   if(ep->seq != rec + 1) return VERROR;
+   return VEOK;
+}  /* end mq_get() */
+
+
+/* Return the records waiting for mirror()  -- in server() */
+word32 mq_count(void)
+{
+   if(Mqring == NULL) return 0;
+   if(Mqring->head - Mqtail > MQLEN) {
+      Mqlost += Mqring->head - Mqtail - MQLEN;
+      Mqtail = Mqring->head - MQLEN;
+   }
+   return Mqring->head - Mqtail;
+}  /* end mq_count() */
@@ -8,28 +8,82 @@
 */
 
 
+byte *Tfmap;   /* tfile.dat mapped by tf_map() in server() */
+long Tfsize;   /* its size when mapped */
+
+
+/* Map tfile.dat in server() at start and after each update(), so
+ * that children serve it from memory they inherit.
+ * Returns VEOK, or VERROR if children must open the file themselves.
+ */
+int tf_map(void)
+{
+   struct stat st;
+   byte *map;
+   int fd;
+
+   if(Tfmap) munmap(Tfmap, Tfsize);
+   Tfmap = NULL;
+   Tfsize = 0;
+   fd = open("tfile.dat", O_RDONLY);
+   if(fd == -1) return VERROR;
+   if(fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return VERROR;
+   }
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED) return error("tf_map(): cannot mmap() tfile.dat");
+   Tfmap = map;
+   Tfsize = st.st_size;
+   return VEOK;
+}  /* end tf_map() */
+
+
+/* Return the trailer of block bnum from the tfile.dat map, which is
+ * indexed by block number, or NULL if it is not there.
+ */
+BTRAILER *tf_trailer(byte *bnum)
+{
+   BTRAILER *bt;
+   word32 n;
+
+   if(Tfmap == NULL || get32(bnum + 4) != 0) return NULL;
+   n = get32(bnum);
+   if(n >= Tfsize / sizeof(BTRAILER)) return NULL;
+   bt = (BTRAILER *) Tfmap + n;
+   if(cmp64(bt->bnum, bnum) != 0) return NULL;
+   return bt;
+}
+
+
+/* Send len bytes of tfile.dat from offset, len < 0 for all of it.
+ * Return VERROR on file errors or reset connection, else VEOK.
+ */
+int send_tfile(NODE *np, long offset, long len)
+{
+   if(Tfmap == NULL) return send_range(np, "tfile.dat", offset, len);
+   if(Trace) plog("sending tfile.dat map");
+   return send_map(np, Tfmap, Tfsize, offset, len);
+}
+
+
 /* Process OP_TF.  Return VEOK on success, else VERROR.
  * Called by child -- execute().
  */
 int send_tf(NODE *np)
 {
-   int status;
    word32 first, count;
-   char cmd[128], fname[32];
-
-   sprintf(fname, "tf%u.tmp", (int) getpid());
 
    first = get32(np->tx.blocknum);      /* first trailer to send */
    count = get32(&np->tx.blocknum[4]);  /* count of trailers to send */
 
    /* limit tfile extract to 1000 trailers */
    if(count > 1000) return VERROR;
-   sprintf(cmd, "dd if=tfile.dat of=%s bs=%u skip=%u count=%u 2>/dev/null",
-                fname, (int) sizeof(BTRAILER), first, count);
-   system(cmd);
-   status = send_file(np, fname);  /* returns VEOK or VERROR */
-   unlink(fname);
-   return status;
+   show("sendtf");
+   /* send straight from tfile.dat -- returns VEOK or VERROR */
+   return send_tfile(np, (long) first * sizeof(BTRAILER),
+                     (long) count * sizeof(BTRAILER));
 }  /* end send_tf() */
 
 
@@ -38,14 +92,18 @@ int send_tf(NODE *np)
  */
 int send_hash(NODE *np)
 {
-   BTRAILER bt;
+   BTRAILER bt, *bp;
    char fname[128];
 
-   sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
-   if(readtrailer(&bt, fname) != VEOK) return VERROR;
+   bp = tf_trailer(np->tx.blocknum);  /* no file access */
+   if(bp == NULL) {
+      sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
+      if(readtrailer(&bt, fname) != VEOK) return VERROR;
+      bp = &bt;
+   }
    memset(TRANBUFF(&np->tx), 0, TRANLEN);
    /* copy hash of tx.blocknum to TX */
-   memcpy(TRANBUFF(&np->tx), bt.bhash, HASHLEN);
+   memcpy(TRANBUFF(&np->tx), bp->bhash, HASHLEN);
    put16(np->tx.len, HASHLEN);
    return send_op(np, OP_HASH);  /* send back to peer */
 }  /* end send_hash() */
@@ -4,20 +4,283 @@
  * See LICENSE.PDF   **** NO WARRANTY ****
  *
  * Date: 9 January 2018
+ * Revised: 19 October 2026
+ *
+ * Pink lists and per-IP rate limits live in one open-addressed hash
+ * table, Peers[], so each accept() costs one probe sequence instead of
+ * a scan of every list.  pinklist() bans an IP for BANTIME seconds,
+ * doubled on each repeat up to BANMAX, and the count is forgiven after
+ * BANMAX seconds of good behaviour.  The epoch pink list is a flag
+ * cleared by purge_epoch().  Connects and OP_TX's from each IP are
+ * paced by token buckets.  When Peers[] is full, a new IP takes the
+ * place of the least recently active unbanned entry near a clock
+ * hand.  Bans are never dropped to make room.  Only the server parent
+ * adds to Peers[].
+ * With -aN it is moved to shared memory by pink_share() so acceptor()
+ * processes can read the bans, and they send theirs to the parent.
+ * Acceptors also take connect tokens from the shared buckets, which
+ * server() fills for all of Peers[] each second with pink_refill().
+ * A new IP is let in by an acceptor and charged by server().
 */
 
+#if (PEERLEN & (PEERLEN - 1)) != 0
+#error Fix PEERLEN: It must be a power of 2
+#endif
+
+#define PEERMAX    (PEERLEN / 4 * 3)  /* keep empty slots for probing */
+#define BANMAX     ((time_t) BANTIME << BANSHIFT)
+#define PEERIDLE   60   /* seconds after which an unbanned entry is dropped */
+#define PEEREVICT  64   /* entries peer_evict() looks at */
+
+#define PK_EPINK   1    /* on epoch pink list */
+
+/* peer_take() buckets */
+#define PT_CONNECT 0
+#define PT_TX      1
+
+typedef struct {
+   word32 ip;        /* zero marks an empty slot */
+   byte flags;       /* PK_EPINK */
+   byte bans;        /* pinklist() count for ban escalation */
+   volatile word16 ctok;  /* connect tokens, taken by acceptor()'s too */
+   word32 ttok;      /* OP_TX tokens */
+   time_t tokt;      /* last time tokens were added to a bucket */
+   time_t until;     /* pinklisted until this time */
+} PEER;
+
+PEER Peertab[PEERLEN];
+PEER *Peers = Peertab;
+word32 Npeers;       /* used slots in Peers[] */
+pid_t Peerowner;     /* only writer of shared Peers[], or zero */
+
+#define pink_owner()  (Peerowner == 0 || Peerowner == getpid())
+
+#define peer_next(h)  (((h) + 1) & (PEERLEN - 1))
+
+
+word32 peer_hash(word32 ip)
+{
+   ip *= 2654435761U;  /* Knuth */
+   return (ip ^ (ip >> 16)) & (PEERLEN - 1);
+}
+
+
+/* Return the Peers[] entry of ip, or NULL if there is none. */
+PEER *peer_find(word32 ip)
+{
+   word32 h;
+
+   if(ip == 0) return NULL;
+   for(h = peer_hash(ip); Peers[h].ip != 0; h = peer_next(h))
+      if(Peers[h].ip == ip) return &Peers[h];
+   return NULL;
+}
+
+
+/* Drop the entries that hold no ban and no rate state. */
+void pink_sweep(void)
+{
+   static PEER keep[PEERMAX];
+   PEER *pp;
+   word32 h, j, n;
+   time_t now;
+
+   if(!pink_owner()) return;
+   now = time(NULL);
+   for(n = j = 0; j < PEERLEN; j++) {
+      pp = &Peers[j];
+      if(pp->ip == 0) continue;
+      if(pp->flags == 0 && now - pp->until > BANMAX
+         && now - pp->tokt > PEERIDLE) continue;
+      keep[n++] = *pp;
+   }
+   if(Trace) plog("pink_sweep(): %u of %u peers left", n, Npeers);
+   /* re-insert what is left */
+   memset(Peers, 0, PEERLEN * sizeof(PEER));
+   for(j = 0; j < n; j++) {
+      for(h = peer_hash(keep[j].ip); Peers[h].ip != 0; h = peer_next(h));
+      Peers[h] = keep[j];
+   }
+   Npeers = n;
+}  /* end pink_sweep() */
+
+
+/* Empty slot h of Peers[] and move later entries of its probe run
+ * back, so that each one can still be found from its hash.
+ */
+void peer_del(word32 h)
+{
+   word32 j, k;
+
+   Peers[h].ip = 0;
+   for(j = peer_next(h); Peers[j].ip != 0; j = peer_next(j)) {
+      k = peer_hash(Peers[j].ip);
+      /* j stays if its home k lies cyclically in (h, j] */
+      if(h <= j ? (h < k && k <= j) : (h < k || k <= j)) continue;
+      Peers[h] = Peers[j];
+      Peers[j].ip = 0;
+      h = j;
+   }
+   Npeers--;
+}  /* end peer_del() */
+
+
+/* Make room in a full Peers[]: pink_sweep() at most once a second,
+ * else drop the least recently active of the next PEEREVICT entries
+ * that is not banned.
+ * Returns VEOK, or VERROR if there is no room.
+ */
+int peer_evict(void)
+{
+   static time_t sweeptime;
+   static word32 hand;
+   PEER *pp, *victim;
+   word32 j;
+   time_t now;
+
+   now = time(NULL);
+   if(now != sweeptime) {
+      sweeptime = now;
+      pink_sweep();
+      if(Npeers < PEERMAX) return VEOK;
+   }
+   victim = NULL;
+   for(j = 0; j < PEEREVICT; j++, hand = peer_next(hand)) {
+      pp = &Peers[hand];
+      if(pp->ip == 0 || pp->flags || now < pp->until) continue;
+      if(victim == NULL || pp->tokt < victim->tokt) victim = pp;
+   }
+   if(victim == NULL) return VERROR;
+   peer_del(victim - Peers);
+   return VEOK;
+}  /* end peer_evict() */
+
+
+/* Return the Peers[] entry of ip, adding one if needed,
+ * or NULL if the table is full of bans.
+ */
+PEER *peer_add(word32 ip)
+{
+   PEER *pp;
+   word32 h;
+
+   if(ip == 0 || !pink_owner()) return NULL;
+   pp = peer_find(ip);
+   if(pp) return pp;
+   if(Npeers >= PEERMAX && peer_evict() != VEOK) {
+      if(Trace) plog("peer_add(): Peers[] is full");
+      return NULL;
+   }
+   for(h = peer_hash(ip); Peers[h].ip != 0; h = peer_next(h));
+   pp = &Peers[h];
+   memset(pp, 0, sizeof(PEER));
+   pp->ip = ip;
+   pp->ctok = CONNBURST;
+   pp->ttok = PTXBURST;
+   pp->tokt = time(NULL);
+   Npeers++;
+   return pp;
+}  /* end peer_add() */
+
+
+/* Move Peers[] to shared memory before server() forks acceptor()'s.
+ * From then on, other processes only read it.
+ */
+int pink_share(void)
+{
+   PEER *pp;
+
+   pp = mmap(NULL, sizeof(Peertab), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(pp == MAP_FAILED) return error("pink_share(): cannot mmap() Peers[]");
+   memcpy(pp, Peertab, sizeof(Peertab));
+   Peers = pp;
+   Peerowner = getpid();
+   return VEOK;
+}  /* end pink_share() */
+
+
+/* Add the tokens earned since pp->tokt  -- in server() */
+void peer_fill(PEER *pp, time_t now)
+{
+   word32 dt;
+   word16 tok, full;
+
+   if(now <= pp->tokt) return;
+   if(pp->ctok >= CONNBURST && pp->ttok >= PTXBURST) return;  /* idle */
+   dt = now - pp->tokt;
+   if(dt > PEERIDLE) dt = PEERIDLE;
+   do {
+      tok = pp->ctok;
+      full = (tok + dt * CONNRATE > CONNBURST) ?
+             CONNBURST : tok + dt * CONNRATE;
+   } while(!__sync_bool_compare_and_swap(&pp->ctok, tok, full));
+   pp->ttok = (pp->ttok + dt * PTXRATE > PTXBURST) ?
+              PTXBURST : pp->ttok + dt * PTXRATE;
+   pp->tokt = now;
+}  /* end peer_fill() */
+
+
+/* Fill the buckets of all Peers[] for acceptor()'s.
+ * Called once a second by acc_poll().
+ */
+void pink_refill(void)
+{
+   PEER *pp;
+   time_t now;
+
+   if(!pink_owner()) return;
+   now = time(NULL);
+   for(pp = Peers; pp < &Peers[PEERLEN]; pp++)
+      if(pp->ip) peer_fill(pp, now);
+}
+
+
+/* Take a token from the PT_CONNECT or PT_TX bucket of ip.
+ * An acceptor() takes only connect tokens, and has server() add and
+ * charge an ip that is not in Peers[] yet.
+ * Returns VEOK, or VERROR if ip is over its rate or cannot be
+ * tracked in a Peers[] full of bans.
+ */
+int peer_take(word32 ip, int bucket)
+{
+   PEER *pp;
+   word16 tok;
+
+   if(Disable_pink || ip == 0) return VEOK;
+   if(!pink_owner()) {
+      if(!Acceptor || bucket != PT_CONNECT) return VEOK;
+      pp = peer_find(ip);
+      if(pp == NULL) return acc_connect(ip);
+   } else {
+      pp = peer_add(ip);
+      if(pp == NULL) return VERROR;
+      peer_fill(pp, time(NULL));
+      if(bucket == PT_TX) {
+         if(pp->ttok == 0) return VERROR;
+         pp->ttok--;
+         return VEOK;
+      }
+   }
+   do {
+      tok = pp->ctok;
+      if(tok == 0) return VERROR;
+   } while(!__sync_bool_compare_and_swap(&pp->ctok, tok, tok - 1));
+   return VEOK;
+}  /* end peer_take() */
 
-/* pink lists of EVIL IP addresses read in from disk */
-word32 Cpinklist[CPINKLEN];
-word32 Lpinklist[LPINKLEN];
-word32 Epinklist[EPINKLEN];
-word32 Cpinkidx, Lpinkidx, Epinkidx;
 
 /* Re-read epoch pink list from init(). */
 int readpink(void)
 {
+   static word32 list[EPINKLEN];
+   int j;
+
    if(Trace) plog("reading epoch pink list...");
-   return readlist32(Epinklist, 4, EPINKLEN, "epink.lst", &Epinkidx);
+   readlist32(list, 4, EPINKLEN, "epink.lst", NULL);
+   for(j = 0; j < EPINKLEN && list[j] != 0; j++)
+      epinklist(list[j]);
+   return VEOK;
 }
 
 
@@ -26,55 +289,52 @@ int readpink(void)
  */
 int savepink(void)
 {
-   int j;
+   static word32 list[EPINKLEN];
+   int j, n;
 
    if(Trace) plog("saving epoch pink list...");
 
-   /* save non-zero entries */
-   for(j = 0; j < EPINKLEN; j++)
-      if(Epinklist[j] == 0) break;
+   /* save epoch entries */
+   for(n = j = 0; j < PEERLEN && n < EPINKLEN; j++)
+      if(Peers[j].flags & PK_EPINK) list[n++] = Peers[j].ip;
 
-   write_data(Epinklist, j * 4, "epink.lst");
+   write_data(list, n * 4, "epink.lst");
    return VEOK;
 }  /* end savepink() */
 
 
 int pinklisted(word32 ip)
 {
+   PEER *pp;
+
    if(Disable_pink) return 0;   /* for debug */
 
-   if(search32(ip, Cpinklist, CPINKLEN) != NULL
-      || search32(ip, Lpinklist, LPINKLEN) != NULL
-      || search32(ip, Epinklist, EPINKLEN) != NULL)
-         return 1;
+   pp = peer_find(ip);
+   if(pp == NULL) return 0;
+   if((pp->flags & PK_EPINK) || time(NULL) < pp->until)
+      return 1;
    return 0;
 }
 
 
-/* Add ip address to current pinklist.
- * Call pinklisted() first to check if already on list.
- */
-int cpinklist(word32 ip)
-{
-   if(Cpinkidx >= CPINKLEN)
-      Cpinkidx = 0;
-   Cpinklist[Cpinkidx++] = ip;
-   return VEOK;
-}
-
-/* Add ip address to current pinklist and remove it from
- * current and recent peer lists.
- * Checks the list first...
+/* Ban ip and remove it from current and recent peer lists.
+ * A repeat offender is banned twice as long as last time.
  */
 int pinklist(word32 ip)
 {
+   PEER *pp;
+   time_t now;
+
    if(Trace)
       plog("%s pink-listed", ntoa((byte *) &ip));
 
-   if(!pinklisted(ip)) {
-      if(Cpinkidx >= CPINKLEN)
-         Cpinkidx = 0;
-      Cpinklist[Cpinkidx++] = ip;
+   if(Acceptor) return acc_pink(ip, 0);  /* server() bans */
+   now = time(NULL);
+   pp = peer_add(ip);
+   if(pp != NULL && now >= pp->until) {  /* not banned now */
+      if(now - pp->until > BANMAX) pp->bans = 0;  /* forgiven */
+      pp->until = now + ((time_t) BANTIME << pp->bans);
+      if(pp->bans < BANSHIFT) pp->bans++;
    }
    if(!Disable_pink) {
       remove32(ip, Rplist, RPLISTLEN, &Rplistidx);
@@ -84,54 +344,29 @@ int pinklist(word32 ip)
 }  /* end pinklist() */
 
 
-/* Add ip address to last pinklist.
- * Caller checks if already on list.
- */
-int lpinklist(word32 ip)
-{
-   if(Lpinkidx >= LPINKLEN)
-      Lpinkidx = 0;
-   Lpinklist[Lpinkidx++] = ip;
-   return VEOK;
-}
-
-
 int epinklist(word32 ip)
 {
-   if(Epinkidx >= EPINKLEN) {
+   PEER *pp;
+
+   if(Acceptor) return acc_pink(ip, 1);
+   pp = peer_add(ip);
+   if(pp == NULL) {
       if(Trace) plog("Epoch pink list overflow");
-      Epinkidx = 0;
+      return VERROR;
    }
-   Epinklist[Epinkidx++] = ip;
+   pp->flags |= PK_EPINK;
    return VEOK;
 }
 
 
-/* Call after each epoch.
- * Merges current pink list into last pink list
- * and purges current pink list.
- */
-void mergepinklists(void)
-{
-   int j;
-   word32 ip, *ptr;
-
-   for(j = 0; j < CPINKLEN; j++) {
-      ip = Cpinklist[j];
-      if(ip == 0) continue;  /* empty */
-      ptr = search32(ip, Lpinklist, LPINKLEN);
-      if(ptr == NULL) lpinklist(ip);  /* add to last bad list */
-      Cpinklist[j] = 0;
-   }
-   Cpinkidx = 0;
-}
-
-
 /* Erase Epoch Pink List */
 void purge_epoch(void)
 {
+   int j;
+
    if(Trace) plog("   purging epoch pink list");
    unlink("epink.lst");
-   memset(Epinklist, 0, sizeof(Epinklist));
-   Epinkidx = 0;
+   if(!pink_owner()) return;
+   for(j = 0; j < PEERLEN; j++)
+      Peers[j].flags &= ~PK_EPINK;
 }
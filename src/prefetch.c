@@ -0,0 +1,412 @@
+/* prefetch.c  Fetch a run of blocks from several peers at once
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * pf_init() is given the trailers of blocks first to last, already
+ * checked by the caller, and the peers that agree on them.  Each peer
+ * gets one pf_child() that fetches the block numbers it reads from its
+ * pipe with get_block2(), in turn over one sess_get() session, so a
+ * peer sees one connection and not one per block.  Each call of
+ * pf_step() takes in the results and hands out more blocks, so that
+ * up to PFLEN are on the wire at once, PFDEPTH to a peer, and none
+ * more than PFAHEAD past the last one applied.  A block is kept as
+ * <pfx><bnum>.dat, with its bsig.dat as .sig, only if its trailer is
+ * the very one in tf[], so the caller can apply them strictly in order
+ * as they turn up.  A block that fails goes to another peer.  A peer
+ * is dropped after PFFAILS failures in a row, or at once for a block
+ * that is not the one it agreed to.  A peer that cannot be called or
+ * is busy has sent nothing wrong: it gets no blocks for PFWAIT
+ * seconds, and is dropped only after PFREFUSED of those in a row.
+ * NG blocks are not fetched -- update() makes them.
+ *
+ * catchup() and get_eon() both fetch their blocks this way.
+*/
+
+
+#define PFFAILS    2   /* failures before a peer is dropped */
+#define PFREFUSED  8   /* refused calls before a peer is dropped */
+#define PFWAIT     2   /* seconds a refusing peer gets no blocks */
+#define PFDEPTH    2   /* blocks queued to each peer */
+
+typedef struct {
+   int busy;         /* bnum is with the child of peer */
+   int peer;         /* index in ip[] of its peer, or -1 */
+   int retry;        /* bnum failed and is to be fetched again */
+   byte bnum[8];
+} PFSLOT;
+
+typedef struct {
+   byte bnum[8];
+   int peer;
+   int status;       /* of get_block2() */
+} PFMSG;
+
+typedef struct {
+   word32 ip[PFPEERS];     /* peers that agree on tf[], 0 when dropped */
+   pid_t pid[PFPEERS];     /* pf_child() of each peer, or 0 */
+   int cmd[PFPEERS];       /* pipe of block numbers to it */
+   int load[PFPEERS];      /* blocks it has now */
+   int fails[PFPEERS];     /* failed blocks in a row */
+   int refused[PFPEERS];   /* refused calls in a row */
+   time_t wait[PFPEERS];   /* no blocks for it until then */
+   int npeer;
+   int rr;                 /* next peer to get a block */
+   int res[2];             /* pipe of PFMSG's from the children */
+   int ready;              /* res[] is open */
+   PFSLOT slot[PFLEN];
+   byte first[8];          /* block of tf[0] */
+   byte next[8];           /* next block to hand out */
+   byte last[8];
+   BTRAILER *tf;           /* trailers of first to last */
+   char *pfx;              /* file names start with it */
+} PREFETCH;
+
+
+/* Ask ip for the hash of block bnum with OP_HASH.
+ * Returns VEOK with it in hash, else VERROR.
+ */
+int get_hash(word32 ip, byte *bnum, byte *hash)
+{
+   NODE node;
+
+   if(sess_get(&node, ip, OP_HASH) != VEOK) return VERROR;
+   put64(node.tx.blocknum, bnum);
+   if(send_op(&node, OP_HASH) != VEOK || rx2(&node, 1, 10) != VEOK
+      || get16(node.tx.opcode) != OP_HASH
+      || get16(node.tx.len) != HASHLEN) {
+      busy_check(&node);
+      closesocket(node.sd);
+      return VERROR;
+   }
+   memcpy(hash, TRANBUFF(&node.tx), HASHLEN);
+   sess_put(&node, OP_HASH);
+   return VEOK;
+}  /* end get_hash() */
+
+
+/* Read the trailers of blocks first to last from tfile fname.
+ * Returns them in memory from malloc(), or NULL.
+ */
+BTRAILER *pf_readtf(char *fname, byte *first, byte *last)
+{
+   BTRAILER *tf;
+   FILE *fp;
+   byte count[8];
+   word32 n;
+
+   if(sub64(last, first, count) || get32(count + 4) || get32(first + 4))
+      return NULL;
+   n = get32(count) + 1;
+   tf = malloc(n * sizeof(BTRAILER));
+   if(tf == NULL) return NULL;
+   fp = fopen(fname, "rb");
+   if(fp == NULL) goto bad;
+   if(fseek(fp, (long) get32(first) * sizeof(BTRAILER), SEEK_SET) != 0
+      || fread(tf, sizeof(BTRAILER), n, fp) != n) {
+      fclose(fp);
+      goto bad;
+   }
+   fclose(fp);
+   if(cmp64(tf[0].bnum, first) == 0 && cmp64(tf[n - 1].bnum, last) == 0)
+      return tf;
+bad:
+   free(tf);
+   return NULL;
+}  /* end pf_readtf() */
+
+
+/* Set up pf to fetch blocks first to last, whose trailers are tf[],
+ * from the n peers in ip[] -- zeros are skipped.  File names are
+ * <pfx><bnum>.dat.
+ */
+void pf_init(PREFETCH *pf, BTRAILER *tf, byte *first, byte *last,
+             word32 *ip, int n, char *pfx)
+{
+   int j;
+
+   memset(pf, 0, sizeof(PREFETCH));
+   if(n > PFPEERS) n = PFPEERS;
+   memcpy(pf->ip, ip, n * sizeof(word32));
+   pf->npeer = n;
+   for(j = 0; j < PFLEN; j++) pf->slot[j].peer = -1;
+   if(pipe(pf->res) == 0) {
+      fcntl(pf->res[0], F_SETFL, O_NONBLOCK);
+      pf->ready = 1;
+   } else error("pf_init(): cannot open pipe()");
+   pf->tf = tf;
+   put64(pf->first, first);
+   put64(pf->next, first);
+   if(pf->next[0] == 0) add64(pf->next, One, pf->next);  /* NG */
+   put64(pf->last, last);
+   pf->pfx = pfx;
+}  /* end pf_init() */
+
+
+/* Set fname to the file of bnum with ext. */
+char *pf_fname(PREFETCH *pf, char *fname, byte *bnum, char *ext)
+{
+   sprintf(fname, "%s%s.%s", pf->pfx, bnum2hex(bnum), ext);
+   return fname;
+}
+
+
+/* Fetch each block number read from fd from peer k, and report it
+ * on pf->res[1].  -- in child
+ * Does not return.
+ */
+void pf_child(PREFETCH *pf, int k, int fd)
+{
+   static char sname[64];
+   char fname[64];
+   PFMSG msg;
+
+   memset(&msg, 0, sizeof(msg));
+   msg.peer = k;
+   while(read(fd, msg.bnum, 8) == 8) {
+      Bsigfname = pf_fname(pf, sname, msg.bnum, "sig");
+      msg.status = get_block2(pf->ip[k], msg.bnum,
+                              pf_fname(pf, fname, msg.bnum, "tmp"),
+                              OP_GETBLOCK);
+      if(write(pf->res[1], &msg, sizeof(msg)) != sizeof(msg)) break;
+   }
+   exit(0);  /* pf_stop() closed the pipe */
+}  /* end pf_child() */
+
+
+/* Start the pf_child() of peer k.
+ * Returns VEOK, or VERROR if it cannot.
+ */
+int pf_spawn(PREFETCH *pf, int k)
+{
+   int fd[2], j;
+
+   if(pipe(fd) != 0) return error("pf_spawn(): cannot open pipe()");
+   pf->pid[k] = fork();
+   if(pf->pid[k] < 0) {
+      pf->pid[k] = 0;
+      close(fd[0]);
+      close(fd[1]);
+      return error("pf_spawn(): cannot fork()");
+   }
+   if(pf->pid[k] == 0) {
+      /* child keeps only its own pipe and res[1] */
+      for(j = 0; j < pf->npeer; j++)
+         if(j != k && pf->pid[j]) close(pf->cmd[j]);
+      close(fd[1]);
+      close(pf->res[0]);
+      pf_child(pf, k, fd[0]);
+   }
+   close(fd[0]);
+   pf->cmd[k] = fd[1];
+   return VEOK;
+}  /* end pf_spawn() */
+
+
+/* Remove the partial files of slot sp and set it to be fetched again. */
+void pf_undo(PREFETCH *pf, PFSLOT *sp)
+{
+   char fname[64];
+
+   unlink(pf_fname(pf, fname, sp->bnum, "tmp"));
+   unlink(pf_fname(pf, fname, sp->bnum, "sig"));
+   sp->busy = 0;
+   sp->retry = 1;
+}
+
+
+/* Stop the child of peer k, and if drop, take no more blocks from k.
+ * Its blocks are to be fetched again.
+ */
+void pf_drop(PREFETCH *pf, int k, int drop)
+{
+   PFSLOT *sp;
+
+   if(pf->pid[k]) {
+      close(pf->cmd[k]);
+      kill(pf->pid[k], SIGKILL);  /* holds only its own files */
+      waitpid(pf->pid[k], NULL, 0);
+      pf->pid[k] = 0;
+   }
+   for(sp = pf->slot; sp < &pf->slot[PFLEN]; sp++)
+      if(sp->busy && sp->peer == k) pf_undo(pf, sp);
+   pf->load[k] = 0;
+   if(drop) pf->ip[k] = 0;
+}  /* end pf_drop() */
+
+
+/* Return the index of the next peer that can take a block, other than
+ * avoid if there is another, or -1 if none can now.
+ */
+int pf_peer(PREFETCH *pf, int avoid)
+{
+   time_t now;
+   int j, k;
+
+   now = time(NULL);
+   for(j = 0; j < pf->npeer; j++) {
+      k = pf->rr;
+      pf->rr = (pf->rr + 1) % pf->npeer;
+      if(pf->ip[k] && k != avoid && pf->load[k] < PFDEPTH
+         && now >= pf->wait[k]) return k;
+   }
+   if(avoid >= 0 && pf->ip[avoid] && pf->load[avoid] < PFDEPTH
+      && now >= pf->wait[avoid]) return avoid;
+   return -1;
+}  /* end pf_peer() */
+
+
+/* Hand the block of sp to the child of peer k.
+ * Returns VEOK, or VERROR if k is dropped.
+ */
+int pf_send(PREFETCH *pf, PFSLOT *sp, int k)
+{
+   if(pf->pid[k] == 0 && pf_spawn(pf, k) != VEOK) {
+      pf->ip[k] = 0;
+      return VERROR;
+   }
+   if(write(pf->cmd[k], sp->bnum, 8) != 8) {
+      pf_drop(pf, k, 1);  /* child is gone */
+      return VERROR;
+   }
+   sp->busy = 1;
+   sp->peer = k;
+   pf->load[k]++;
+   return VEOK;
+}  /* end pf_send() */
+
+
+/* Keep the block of sp if the child got it and it has the trailer
+ * in tf[], else count the failure against its peer.
+ * Returns VEOK if it is in, else VERROR.
+ */
+int pf_check(PREFETCH *pf, PFSLOT *sp, int status)
+{
+   BTRAILER bt;
+   byte n[8];
+   char fname[64], tname[64];
+   int k;
+
+   k = sp->peer;
+   sp->busy = 0;
+   pf->load[k]--;
+   pf_fname(pf, tname, sp->bnum, "tmp");
+   if(status == VETIMEOUT) {
+      /* not called, or busy: no fault of the block */
+      pf->wait[k] = time(NULL) + PFWAIT;
+      if(++pf->refused[k] >= PFREFUSED) pf_drop(pf, k, 1);
+      pf_undo(pf, sp);
+      return VERROR;
+   }
+   pf->refused[k] = 0;
+   if(status == VEOK) {
+      sub64(sp->bnum, pf->first, n);
+      if(readtrailer(&bt, tname) == VEOK
+         && memcmp(&bt, &pf->tf[get32(n)], sizeof(BTRAILER)) == 0) {
+         if(rename(tname, pf_fname(pf, fname, sp->bnum, "dat")) == 0) {
+            pf->fails[k] = 0;
+            return VEOK;
+         }
+      } else {
+         if(Trace) plog("pf_check(): %s sent a wrong 0x%s",
+                        ntoa((byte *) &pf->ip[k]), bnum2hex(sp->bnum));
+         pf->fails[k] = PFFAILS;
+      }
+   }
+   pf_undo(pf, sp);
+   if(++pf->fails[k] >= PFFAILS) pf_drop(pf, k, 1);
+   return VERROR;
+}  /* end pf_check() */
+
+
+/* Return non-zero when every block of pf is in. */
+int pf_done(PREFETCH *pf)
+{
+   PFSLOT *sp;
+
+   if(cmp64(pf->next, pf->last) <= 0) return 0;
+   for(sp = pf->slot; sp < &pf->slot[PFLEN]; sp++)
+      if(sp->busy || sp->retry) return 0;
+   return 1;
+}
+
+
+/* Take in the results of the children of pf and hand out more blocks,
+ * up to PFAHEAD past base, the last block applied.  Blocks up to base
+ * are not fetched.
+ * Returns the count of blocks that came in, or -1 if blocks are left
+ * and no peers to fetch them.
+ */
+int pf_step(PREFETCH *pf, byte *base)
+{
+   PFSLOT *sp;
+   PFMSG msg;
+   byte ahead[8];
+   int k, count;
+
+   if(!pf->ready) return -1;
+   count = 0;
+   while(read(pf->res[0], &msg, sizeof(msg)) == sizeof(msg)) {
+      for(sp = pf->slot; sp < &pf->slot[PFLEN]; sp++) {
+         if(!sp->busy || sp->peer != msg.peer) continue;
+         if(cmp64(sp->bnum, msg.bnum) != 0) continue;
+         if(pf_check(pf, sp, msg.status) == VEOK) count++;
+         break;
+      }
+   }
+   for(k = 0; k < pf->npeer; k++) {  /* a child that died */
+      if(pf->pid[k] && waitpid(pf->pid[k], NULL, WNOHANG) == pf->pid[k]) {
+         close(pf->cmd[k]);
+         pf->pid[k] = 0;
+         pf_drop(pf, k, 1);
+      }
+   }
+   if(cmp64(pf->next, base) <= 0) {
+      add64(base, One, pf->next);  /* base came some other way */
+      if(pf->next[0] == 0) add64(pf->next, One, pf->next);
+   }
+   for(sp = pf->slot; sp < &pf->slot[PFLEN]; sp++) {
+      if(sp->busy) continue;
+      if(sp->retry && cmp64(sp->bnum, base) <= 0) sp->retry = 0;
+      if(!sp->retry) {
+         if(cmp64(pf->next, pf->last) > 0) continue;
+         sub64(pf->next, base, ahead);
+         if(get32(ahead + 4) || get32(ahead) > PFAHEAD) continue;
+      }
+      k = pf_peer(pf, sp->retry ? sp->peer : -1);
+      if(k < 0) break;  /* none free now */
+      if(!sp->retry) {
+         put64(sp->bnum, pf->next);
+         add64(pf->next, One, pf->next);
+         if(pf->next[0] == 0) add64(pf->next, One, pf->next);
+      }
+      if(pf_send(pf, sp, k) != VEOK) {
+         sp->retry = 1;
+         sp--;  /* again with another peer */
+         continue;
+      }
+      sp->retry = 0;
+   }
+   for(k = 0; k < pf->npeer; k++)
+      if(pf->ip[k]) return count;
+   return pf_done(pf) ? count : -1;
+}  /* end pf_step() */
+
+
+/* Stop the children of pf and remove their partial files.
+ * The blocks that are in stay.
+ */
+void pf_stop(PREFETCH *pf)
+{
+   int k;
+
+   for(k = 0; k < pf->npeer; k++)
+      pf_drop(pf, k, 0);
+   if(pf->ready) {
+      close(pf->res[0]);
+      close(pf->res[1]);
+      pf->ready = 0;
+   }
+}  /* end pf_stop() */
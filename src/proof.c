@@ -10,7 +10,15 @@
 int readtf(void *buff, word32 bnum, word32 count)
 {
    FILE *fp;
+   word32 n;
 
+   n = Tfsize / sizeof(BTRAILER);
+   if(bnum < n) {  /* copy from the map of tf_map() */
+      if(count > n - bnum) count = n - bnum;
+      memcpy(buff, Tfmap + bnum * sizeof(BTRAILER),
+             count * sizeof(BTRAILER));
+      return count;
+   }
    fp = fopen("tfile.dat", "rb");
    if(fp == NULL) return 0;
    if(fseek(fp, bnum * sizeof(BTRAILER), SEEK_SET)) {
@@ -18,22 +18,84 @@ int update(char *fname, int mode);
 int freeslot(NODE *np);
 int sendtx(NODE *np);
 int send_op(NODE *np, int opcode);
-int gettx(NODE *np, SOCKET sd);
+void settxhdr(NODE *np);
+int sendv(NODE *np, struct iovec *vp, int n);
+word16 crc_tranlen(word16 crc);
+int sendtxv(NODE *np, void *data, int len, word16 *dcrc);
+int txvlen(NODE *np, void *data, int len);
+int send_frame(NODE *np, int opcode, void *data, int len, word16 *dcrc);
+int hs_open(NODE *np, SOCKET sd);
+void hs_closeall(void);
+int hs_keep(NODE *np);
+int gettx(NODE *np);
+int tx_in(NODE *np);
+int tx_recv(NODE *np);
 NODE *getslot(NODE *np);
 
 /* Source file: execute.c */
 int process_tx(NODE *np);
 int sendnack(NODE *np);
+int send_data(NODE *np, byte *data, long len, word16 *crcs);
+int send_map(NODE *np, byte *map, long size, long offset, long len);
+int send_range(NODE *np, char *fname, long offset, long len);
 int send_file(NODE *np, char *fname);
+int send_files(NODE *np);
 int send_ipl(NODE *np);
+int cb_map(void);
+
+/* Source file: load.c */
+int load_shed(NODE *np);
+
+/* Source file: hotblock.c */
+void hb_update(void);
+void hb_touch(byte *bnum);
+int hb_send(NODE *np, byte *bnum, long offset);
+
+/* Source file: catchup.c */
+int catchup(word32 ip, TX *tx);
+
+/* Source file: inv.c */
+void inv_add(word32 ip, byte *tx_id);
+int inv_recv(NODE *np);
+
+/* Source file: compact.c */
+int send_compact(NODE *np);
+int get_compact(word32 ip, byte *bnum, char *fname);
 int execute(NODE *np);
 int identify(NODE *np);
+int get_block3(NODE *np, char *fname);
 
+int rxcheck(NODE *np, int checkids);
+int rx_step(NODE *np);
 int rx2(NODE *np, int checkids, int seconds);
+word32 get_xcaps(TX *tx);
+int busy_init(void);
+void busy_check(NODE *np);
+int busy_peer(word32 ip);
 int callserver(NODE *np, word32 ip);
+int sess_class(int opcode);
+int sess_get(NODE *np, word32 ip, int opcode);
+void sess_put(NODE *np, int opcode);
 int get_tx2(NODE *np, word32 ip, word16 opcode);
 int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode);
 
+/* Source file: pink.c */
+int pinklisted(word32 ip);
+int pinklist(word32 ip);
+int epinklist(word32 ip);
+void pink_sweep(void);
+int pink_share(void);
+
+/* Source file: acceptor.c */
+int acc_pink(word32 ip, int epoch);
+int acc_connect(word32 ip);
+int acc_request(NODE *np);
+void acc_tip(void);
+void acc_gettip(void);
+int acc_init(SOCKET lsd);
+void acc_poll(void);
+void acc_stop(void);
+
 /* Source file: init.c */
 int get_ipl(NODE *np, word32 ip);
 int read_coreipl(char *fname);
@@ -54,6 +116,9 @@ void stop_mirror(void);
 int send_balance(NODE *np);
 
 /* Source file: optf.c */
+int tf_map(void);
+BTRAILER *tf_trailer(byte *bnum);
+int send_tfile(NODE *np, long offset, long len);
 int send_tf(NODE *np);
 int send_hash(NODE *np);
 
@@ -63,7 +63,6 @@ int refresh_ipl(void)
    NODE node;
    int j, message = 0;
    word32 ip;
-   byte bnum[8];
 
    for(j = ip = 0; j < 1000 && ip == 0; j++)
       ip = Rplist[rand16() % RPLISTLEN];
@@ -74,14 +73,7 @@ int refresh_ipl(void)
    /* ignore low weight */
    if(cmp_weight(node.tx.weight, Weight) <= 0) BAIL(4);
 
-   /* catchup loop */
-   put64(bnum, Cblocknum);
-   for( ; Running; ) {
-      add64(bnum, One, bnum);
-      if(bnum[0] == 0) continue;  /* do not fetch NG blocks */
-      if(get_block2(ip, bnum, "refresh.tmp", OP_GETBLOCK) != VEOK) BAIL(5);
-      if(update("refresh.tmp", 0) != VEOK) BAIL(6);
-   }
+   if(catchup(ip, NULL) != VEOK) BAIL(5);  /* in the background */
 bail:
    if(Trace) plog("refresh_ipl(): %d", message);
    return message;
@@ -16,15 +16,13 @@
  */
 int server(void)
 {
-   static time_t nsd_time;  /* event timers */
-   static time_t bctime, mwtime, mqtime;
-   static time_t ipltime;
+   static time_t bctime, mwtime, mqtime;  /* event timers */
+   static time_t ipltime, loadtime;
    static SOCKET lsd, nsd;
-   static NODE *np, node;
+   static NODE *np, *hp;
    static struct sockaddr_in addr;
    static int status;   /* child return status */
    static pid_t pid;    /* child pid */
-   static int lfd;      /* for lock() */
    static word32 hps;  /* same as Hps in monitor.c */
    static word32 bigwait;
 
@@ -41,6 +39,16 @@ int server(void)
    Bridgetime = Time0 + BRIDGE;  /* pseudo-block timer */
    bigwait = (60*60*24) + (rand2() % 10800);  /* 1 day + ~ 3 hours */
    ipltime = Ltime + (rand2() % 600) + 10;  /* ip list fetch time */
+   fappend_recover("txq1.dat", "txclean.dat");
+   /* Txcount is 0, so txq1.dat must be empty for txq_put() */
+   fappend("txq1.dat", "txclean.dat", sizeof(TXQENTRY));
+   Nclean = txq_trim("txclean.dat", Txqmax);  /* left by resume */
+   Mpsynctime = Ltime + 5;  /* warm up mempool from a peer */
+   if(Bwslot == NULL) bw_init();  /* before any fork() */
+   if(Mqring == NULL) mq_init();
+   if(Custate == NULL) cu_init();
+   busy_init();                   /* if init() did not */
+   tf_map();                      /* and for send_tf() children */
 
    if((lsd = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
       fatal("Cannot open listening socket.");
@@ -49,6 +57,14 @@ int server(void)
    addr.sin_addr.s_addr = INADDR_ANY;
    addr.sin_family = AF_INET;
 
+#ifdef SO_REUSEPORT
+   if(Acceptors) {  /* share Port with acceptor() processes */
+      status = 1;
+      setsockopt(lsd, SOL_SOCKET, SO_REUSEPORT, (void *) &status,
+                 sizeof(status));
+   }
+#endif
+
    show("bind");
    for(;;) {
       if(!Running) { closesocket(lsd); return 0; }
@@ -62,7 +78,7 @@ int server(void)
    if(nonblock(lsd) == -1)
       fatal("nonblock() failed on lsd.");
    listen(lsd, LQLEN);  /* LQSIZ */
-   nsd = INVALID_SOCKET;
+   if(Acceptors) acc_init(lsd);
 
    if(Safemode && !iszero(Cblocknum, 8)) {
       plog("Safemode");
@@ -90,6 +106,7 @@ int server(void)
          pid = waitpid(np->pid, &status, WNOHANG);
          if(pid <= 0) continue;  /* child still running or signal */
          freeslot(np);
+         bw_reap(np);  /* add up bytes served */
          if(Trace) plog("np->pid: %d  pid: %d  status: 0x%x  op: %d  (%d)",
                         np->pid, pid, status, np->opcode, errno);  /* debug */
          /* Adds to lists if needed and returns exit status 0-3 */
@@ -120,62 +137,69 @@ int server(void)
          }
       }  /* end for check Node[] zombies */
 
+      /* Apply the next block from catchup() */
+      if(Cupid) cu_apply();
+
       /* Reap a send_found() child.  If she is done, pid != 0. */
       if(Sendfound_pid > 0) {
          pid = waitpid(Sendfound_pid, &status, WNOHANG);
          if(pid > 0) Sendfound_pid = 0;
       }
 
-      /* Check for new connection with accept() and set nsd. */
-      if(nsd == INVALID_SOCKET) {
-         if((nsd = accept(lsd, NULL, NULL)) != INVALID_SOCKET) {
-            nonblock(nsd);
-            nsd_time = Ltime;
-         }
+      /* Check for new connections with accept() into free
+       * handshake slots in Hsnodes[].
+       */
+      for(hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++) {
+         if(hp->state != HS_IDLE) continue;
+         if((nsd = accept(lsd, NULL, NULL)) == INVALID_SOCKET) break;
+         nonblock(nsd);
+         if(hs_open(hp, nsd) != VEOK) closesocket(nsd);
       }
 
       /*
-       * If accept() good,
-       * try to read data from socket, nsd, using gettx().
+       * Step each handshake in progress with gettx().
        */
-      if(nsd != INVALID_SOCKET) {
-         /* gettx() completes the initial handshake and fills node
-          * and some parent tables.  It returns -1 if no data yet.
+      for(hp = Hsnodes; hp < &Hsnodes[HSLEN]; hp++) {
+         if(hp->state == HS_IDLE) continue;
+         /* gettx() completes the initial handshake a piece at a time
+          * and fills *hp and some parent tables.  It returns -1 until
+          * the handshake is done or times out.
           * If gettx() completes the transaction, it returns 0, 1, 2, or 3;
           * otherwise it returns sizeof(TX) and needs help from child
-          * so getslot() allocates a new np and copies node into it.
+          * so getslot() allocates a new np and copies *hp into it.
           */
-         status = gettx(&node, nsd);  /* fills in node */
-         if(status != -1) {
-            if(status == sizeof(TX) && (np = getslot(&node)) != NULL) {
-               pid = fork();  /* create child to handle TX */
-               if(pid == 0) {
-                  /* in child */
-                  exit(execute(np));  /* parent calls waitpid() for status */
-               }
-               /* parent puts valid child pid in parent table */
-               if(pid != -1) np->pid = pid;
-               else {
-                  /* fork() failed so freeslot() removes child data from
-                   * parent Node[] table.
-                   */
-                  freeslot(np);
-                  error("fork() failed!");
-                  restart("cannot fork()");
-               }
-            }  /* end if need child and slot found */
-            /* parent closes its socket if gettx() did not */
-            if(node.sd != INVALID_SOCKET)
-               closesocket(nsd);
-            nsd = INVALID_SOCKET;
-         } else {   /* status == -1 no data yet -- so check timeout */
-            if(Ltime - nsd_time > INIT_TIMEOUT) {
-               Ntimeouts++;  /* log statistics */
-               closesocket(nsd);
-               nsd = INVALID_SOCKET;
+         status = gettx(hp);  /* fills in *hp */
+         if(status == -1) continue;
+         hp->state = HS_IDLE;  /* free the slot */
+         if(status == sizeof(TX) && (np = getslot(hp)) != NULL) {
+            pid = fork();  /* create child to handle TX */
+            if(pid == 0) {
+               /* in child */
+               hs_closeall();  /* not ours */
+               exit(execute(np));  /* parent calls waitpid() for status */
             }
-         }  /* end if timeout */
-      }  /* endif nsd valid */
+            /* parent puts valid child pid in parent table */
+            if(pid != -1) np->pid = pid;
+            else {
+               /* fork() failed so freeslot() removes child data from
+                * parent Node[] table.
+                */
+               freeslot(np);
+               error("fork() failed!");
+               restart("cannot fork()");
+            }
+         }  /* end if need child and slot found */
+         /* parent closes its socket */
+         closesocket(hp->sd);
+      }  /* end for Hsnodes[] */
+
+      /* TX's and requests read by acceptor()'s for us */
+      if(Acceptors) acc_poll();
+
+      if(Ltime != loadtime) {
+         load_update();  /* for load_shed() in gettx() */
+         loadtime = Ltime;
+      }
 
       Ngen++;  /* loop counter */
 
@@ -200,16 +224,17 @@ int server(void)
        */
       if(Txcount >= TXQUEBIG)
          bctime = Ltime;
-      if(Bcpid == 0 && Blockfound == 0
+      if(Bcpid == 0 && Blockfound == 0 && Cupid == 0
          && Ltime >= bctime
          && (Txcount > 0 || (Mpid == 0 && existsnz("txclean.dat")))) {
-         /* append txq1.dat to txclean.dat */
-         system("cat txq1.dat >>txclean.dat 2>/dev/null");
-         unlink("txq1.dat");
-         stop_miner();  /* pause miner during block construction */
          if(Trace)
             plog("spawning bcon with %d more transactions", Txcount);
-         Txcount = 0;  /* txq1.dat is empty now */
+         /* append txq1.dat to txclean.dat -- on error, try next time */
+         if(fappend("txq1.dat", "txclean.dat", sizeof(TXQENTRY)) == VEOK)
+            Txcount = 0;  /* txq1.dat is empty now */
+         /* evict low fees */
+         Nclean = txq_trim("txclean.dat", Txqmax - Txcount);
+         stop_miner();  /* pause miner during block construction */
          put64(Bcbnum, Cblocknum);  /* save current block number */
          write_global();
          Bcpid = fork();
@@ -246,25 +271,36 @@ int server(void)
       }
 
       /* Start mirror()? */
-      if(Ltime >= mqtime && Mqcount > 0 && Mqpid == 0) {
-         /* get exclusive access to txq1.dat */
-         lfd = lock("mq.lck", 10);
-         if(lfd != -1) {
-            unlink("mirror.dat");
-            rename("mq.dat", "mirror.dat");
-            Mqcount = 0;
-            unlock(lfd);
-            Mqpid = mirror();  /* start child */
-         }
+      if(Ltime >= mqtime && Mqpid == 0 && mq_count() > 0) {
+         Mqend = Mqring->head;  /* child sends Mqtail to Mqend */
+         Mqpid = mirror();  /* start child */
       }
       if(Mqpid) {
-         pid = waitpid(Mqpid, NULL, WNOHANG);
+         pid = waitpid(Mqpid, &status, WNOHANG);
          if(pid > 0) {
+            if(WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM)
+               error("mirror() died on signal %d", WTERMSIG(status));
             Mqpid = 0;
+            Mqtail = Mqend;  /* the ring needs no clean up */
             mqtime = Ltime + 2;
          }
       }
 
+      /* Start mpsync() after start-up or catchup()? */
+      if(Mpsynctime && Ltime >= Mpsynctime && Mspid == 0 && !Mpsload) {
+         Mpsynctime = 0;
+         Mspid = mpsync();  /* start child */
+      }
+      if(Mspid) {
+         pid = waitpid(Mspid, &status, WNOHANG);
+         if(pid > 0) {
+            Mspid = 0;
+            Mpsload = (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+         }
+      }
+      /* Queue a few of her TX's each loop */
+      if(Mpsload) Mpsload = mpsync_load(MPSYNCLEN);
+
       if(TIMES_OF_TROUBLE()) {
          if(bridge() != VEOK || update("pblock.dat", 2) != VEOK) {
             restart("Cannot make pseudo-block");
@@ -304,5 +340,7 @@ int server(void)
     * Clean up server and exit
     */
    closesocket(lsd);  /* close listening socket */
+   acc_stop();        /* and other processes' */
+   hs_closeall();     /* and handshakes in progress */
    return 0;          /* main() will finish cleanup */
 } /* end server() */
@@ -36,6 +36,8 @@
 #include <resolv.h>
 #include <sys/types.h>
 #include <termios.h>     /* for FIONBIO */
+#include <sys/uio.h>     /* for writev() */
+#include <poll.h>
 #ifndef SOCKET
 #define SOCKET int
 #endif
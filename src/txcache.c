@@ -0,0 +1,92 @@
+/* txcache.c  Recent tx_id cache to drop duplicate TX's early
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * The same TX arrives many times from the mirror fan-out of our peers.
+ * gettx() probes this direct-mapped table right after the OP_TX frame
+ * is read, so a duplicate costs one probe instead of tx_val() and a
+ * txcheck() file scan.  Only the server parent touches Txcache[],
+ * so no locks are needed.
+ *
+ * Entries are keyed by tx_id (sha256 of src_addr), not by crc32,
+ * so a forged crc cannot shadow somebody else's transaction.
+*/
+
+#if (CRCLISTLEN & (CRCLISTLEN - 1)) != 0
+#error Fix CRCLISTLEN: It must be a power of 2
+#endif
+
+/* Txcache[].status values: 1, 2, or 3 are process_tx() reject codes. */
+#define TXC_EMPTY   0
+#define TXC_ACCEPT  255   /* a TX from src_addr is in txq1 or txclean */
+
+typedef struct {
+   byte tx_id[HASHLEN];   /* sha256 of src_addr */
+   byte txhash[HASHLEN];  /* sha256 of whole TX buffer -- rejects only */
+   word32 bnum;           /* low word of Cblocknum when entered */
+   byte status;           /* TXC_ACCEPT or reject code */
+} TXCENTRY;
+
+TXCENTRY Txcache[CRCLISTLEN];
+
+#define txcache_slot(tx_id) (&Txcache[get32(tx_id) & (CRCLISTLEN - 1)])
+
+
+/* Look up tx in the cache and set tx_id[] to sha256 of tx->src_addr.
+ * Returns TXC_EMPTY on a miss, TXC_ACCEPT if a TX from the same src_addr
+ * is already queued, or the reject code from when this very same
+ * transaction was last seen.
+ */
+int txcache_find(TX *tx, byte *tx_id)
+{
+   TXCENTRY *cp;
+   byte txhash[HASHLEN];
+
+   Ntxprobes++;
+   sha256(tx->src_addr, TXADDRLEN, tx_id);
+   cp = txcache_slot(tx_id);
+   if(cp->status == TXC_EMPTY) return TXC_EMPTY;
+   if(memcmp(cp->tx_id, tx_id, HASHLEN) != 0) return TXC_EMPTY;
+   if(cp->status != TXC_ACCEPT) {
+      /* A ledger-dependent reject may pass after the next block. */
+      if(cp->status == 1 && cp->bnum != get32(Cblocknum)) return TXC_EMPTY;
+      /* A reject only covers the exact same transaction. */
+      sha256(TRANBUFF(tx), TRANLEN, txhash);
+      if(memcmp(cp->txhash, txhash, HASHLEN) != 0) return TXC_EMPTY;
+   }
+   Ntxhits++;
+   if(Trace) plog("txcache_find(): hit status = %d", cp->status);
+   return cp->status;
+}  /* end txcache_find() */
+
+
+/* Remember the outcome of a TX whose tx_id[] was set by txcache_find().
+ * status is TXC_ACCEPT, or the reject code from process_tx().
+ */
+void txcache_add(TX *tx, byte *tx_id, int status)
+{
+   TXCENTRY *cp;
+
+   cp = txcache_slot(tx_id);
+   memcpy(cp->tx_id, tx_id, HASHLEN);
+   if(status != TXC_ACCEPT)
+      sha256(TRANBUFF(tx), TRANLEN, cp->txhash);
+   cp->bnum = get32(Cblocknum);
+   cp->status = status;
+}  /* end txcache_add() */
+
+
+/* Forget tx_id, a queued TX that was evicted, so that a TX from the
+ * same src_addr can come in again.
+ */
+void txcache_drop(byte *tx_id)
+{
+   TXCENTRY *cp;
+
+   cp = txcache_slot(tx_id);
+   if(cp->status == TXC_ACCEPT && memcmp(cp->tx_id, tx_id, HASHLEN) == 0)
+      cp->status = TXC_EMPTY;
+}
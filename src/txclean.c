@@ -77,12 +77,14 @@ int txclean(void)
 
    if(Trace && nout) plog("txclean.c: wrote %u entries from %u"
                           " to new txclean.dat", nout, tnum);
+   Nclean = txq_trim("txclean.dat", Txqmax);
    return 0;        /* success */
 
 bail:
    if(fp) fclose(fp);
    if(fpout) fclose(fpout);
    unlink("txq.tmp");
+   Nclean = txqcount("txclean.dat");
    if(Trace) plog("txclean(): %d", message);
    return message;
 }  /* end txclean() */
@@ -29,7 +29,13 @@
 #define OP_HASH           17
 #define OP_TF             18
 #define OP_IDENTIFY       19
-#define LAST_OP           19  /* edit when adding  OP's */
+#define OP_GET_TXIDS      20  /* needs X_MPSYNC */
+#define OP_GET_TXLIST     21  /* needs X_MPSYNC */
+#define OP_GET_CMPCT      22  /* needs X_COMPACT */
+#define OP_GET_BLTX       23  /* needs X_COMPACT */
+#define OP_INV            24  /* needs X_INV */
+#define OP_INV_WANT       25  /* needs X_INV */
+#define LAST_OP           25  /* edit when adding  OP's */
 
 #define TXNETWORK 0x0539
 #define TXEOT     0xabcd
@@ -64,6 +70,19 @@
 #define C_SANCTUARY 4
 #define C_MFEE      8
 #define C_LOGGING   16
+#define C_VARLEN    32   /* compact frames after the handshake */
+#define C_EXTCAP    128  /* blocknum[0..3] of HELLO and HELLO_ACK is Xcaps */
+
+/* Extended capability bits in Xcaps */
+#define X_MPSYNC    1    /* OP_GET_TXIDS and OP_GET_TXLIST */
+#define X_SESSION   2    /* keep-alive sessions -- see sess_get() */
+#define X_RESUME    4    /* offset in OP_GETBLOCK and OP_GET_TFILE */
+#define X_COMPACT   8    /* OP_GET_CMPCT and OP_GET_BLTX -- compact.c */
+#define X_INV       16   /* OP_INV and OP_INV_WANT -- inv.c */
+
+/* sess_class() of an opcode */
+#define SESS_PARENT 1    /* served by server() -- session stays there */
+#define SESS_FILE   2    /* served by a child -- file requests only */
 
 /* Multi-byte numbers are little-endian.
  * Structure is checked on start-up for byte-alignment.
@@ -100,11 +119,32 @@ typedef struct {
    word16 id1;      /* from tx */
    word16 id2;      /* from tx */
    int opcode;      /* from tx */
+   byte caps;       /* peer Cbits from OP_HELLO or OP_HELLO_ACK */
+   word32 xcaps;    /* peer Xcaps from OP_HELLO or OP_HELLO_ACK */
    word32 src_ip;
    SOCKET sd;
    pid_t pid;     /* process id of child -- zero if empty slot */
+   word16 rlen;       /* bytes of frame received so far by rx_step() */
+   word16 flen;       /* bytes in tx of a compact frame, 0 if full */
+   byte state;        /* HS_ handshake state in server() */
+   time_t deadline;   /* for the current handshake state */
 } NODE;
 
+/* Frames to and from np are compact: both ends have C_VARLEN.
+ * OP_HELLO and OP_HELLO_ACK are always sent full.
+ */
+#define varlen_rx(np)  ((np)->caps & Cbits & C_VARLEN)
+#define varlen(np)     (varlen_rx(np)                                \
+                        && get16((np)->tx.opcode) != OP_HELLO        \
+                        && get16((np)->tx.opcode) != OP_HELLO_ACK)
+
+/* NODE.state of Hsnodes[] in server() */
+#define HS_IDLE   0  /* empty slot */
+#define HS_HELLO  1  /* reading OP_HELLO */
+#define HS_OP     2  /* sent OP_HELLO_ACK, reading request */
+#define HS_SESS   3  /* session idle, reading next request */
+#define HS_READY  4  /* request read by acceptor(), see acc_poll() */
+
 
 /* Structure for clean TX que */
 typedef struct {
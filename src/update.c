@@ -10,8 +10,6 @@
 /* Creates child to send OP_FOUND to all recent peers */
 int send_found(void)
 {
-   word32 *ipp;
-   NODE node;
    BTRAILER bt;
    char fname[128];
    int ecode;
@@ -53,23 +51,9 @@ bad:
       plog("send_found(0x%s)", bnum2hex(Cblocknum));
 
    loadproof(&tx);  /* get proof from tfile.dat */
-   /* Send found message to recent peers */
-   shuffle32(Rplist, RPLISTLEN);
-   for(ipp = Rplist; ipp < &Rplist[RPLISTLEN] && Running; ipp++) {
-      if(*ipp == 0) continue;
-      if(callserver(&node, *ipp) != VEOK) continue;
-      memcpy(&node.tx, &tx, sizeof(TX));  /* copy in tfile proof */
-      send_op(&node, OP_FOUND);
-      closesocket(node.sd);
-   }
-   /* Send found message to local peers */
-   for(ipp = Lplist; ipp < &Lplist[LPLISTLEN] && Running; ipp++) {
-      if(*ipp == 0) continue;
-      if(callserver(&node, *ipp) != VEOK) continue;
-      memcpy(&node.tx, &tx, sizeof(TX));  /* copy in tfile proof */
-      send_op(&node, OP_FOUND);
-      closesocket(node.sd);
-   }
+   /* Send found message to recent and local peers at once */
+   shuffle32(Rplist, RPLISTLEN);  /* mix peers with the same time */
+   found_all(&tx);
    exit(0);
 }  /* end send_found() */
 
@@ -110,6 +94,7 @@ void reaper2(void)
          kill(np->pid, SIGTERM);
          waitpid(np->pid, NULL, 0);
          freeslot(np);
+         bw_reap(np);
       }
    }
 }  /* end reaper2() */
@@ -213,7 +198,7 @@ after_bup:
       purge_epoch();
    /* rename and move ublock.dat to the bc/ directory */
    if(moveublock("ublock.dat", Cblocknum) != VEOK) goto err;
-   mergepinklists();
+   pink_sweep();
    if(write_global() != VEOK) goto err;     /* for miner */
    if(Cblocknum[0] == 0xff) {
       if(do_neogen() != VEOK) goto err;
@@ -252,6 +237,9 @@ after_bup:
       }
    }
    Bridgetime = Time0 + BRIDGE;
+   tf_map();  /* new tfile.dat for send_tf() children */
+   hb_update();  /* and the new blocks */
+   acc_tip();  /* and the new tip for acceptor()'s */
    return VEOK;
 err:
    restart("update error!");
@@ -29,6 +29,8 @@
 #include <sys/time.h>
 #include <sys/wait.h>  /* for waitpid() */
 #include <sys/file.h>  /* for flock() */
+#include <sys/stat.h>  /* for fstat() */
+#include <sys/mman.h>  /* for mmap() */
 #include <termios.h>
 #include <dirent.h>
 
@@ -668,6 +670,94 @@ int dclear(char *dname)
    return 0;
 } /* end dclear() */
 
+
+/* Append the whole reclen sized records of fname to tofname, then
+ * remove fname.  tofname is fsync()'d before fname is removed, and the
+ * old length of tofname is kept in tofname.jnl until then so that
+ * fappend_recover() can undo a partial append after a crash.
+ * Returns VEOK on success (or if there is nothing to append),
+ * else VERROR.
+ */
+int fappend(char *fname, char *tofname, long reclen)
+{
+   static byte buff[65536];
+   char jfname[128];
+   struct stat st;
+   off_t off;
+   long len, n;
+   int fd, tofd, jfd;
+
+   fd = open(fname, O_RDONLY);
+   if(fd == -1) return VEOK;  /* nothing to append */
+   if(fstat(fd, &st) != 0) { close(fd); return VERROR; }
+   len = st.st_size - (st.st_size % reclen);  /* drop a torn record */
+   if(len == 0) {
+      close(fd);
+      unlink(fname);
+      return VEOK;
+   }
+   tofd = open(tofname, O_WRONLY | O_CREAT | O_APPEND, 0666);
+   if(tofd == -1) {
+      close(fd);
+      return error("fappend(): cannot open %s", tofname);
+   }
+   off = lseek(tofd, 0, SEEK_END);
+   /* journal the old length of tofname */
+   sprintf(jfname, "%s.jnl", tofname);
+   jfd = open(jfname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if(jfd == -1 || write(jfd, &off, sizeof(off)) != sizeof(off)
+      || fsync(jfd) != 0) {
+      if(jfd != -1) close(jfd);
+      close(fd);
+      close(tofd);
+      unlink(jfname);
+      return error("fappend(): cannot write %s", jfname);
+   }
+   close(jfd);
+   /* copy records */
+   for( ; len > 0; len -= n) {
+      n = read(fd, buff,
+               len < (long) sizeof(buff) ? len : (long) sizeof(buff));
+      if(n <= 0 || write(tofd, buff, n) != n) break;
+   }
+   close(fd);
+   if(len != 0 || fsync(tofd) != 0) {
+      if(ftruncate(tofd, off) == 0) unlink(jfname);
+      close(tofd);
+      return error("fappend(): I/O error on %s", tofname);
+   }
+   close(tofd);
+   unlink(fname);
+   unlink(jfname);
+   return VEOK;
+}  /* end fappend() */
+
+
+/* Undo or complete an fappend() that was interrupted by a crash.
+ * If fname is still there, tofname is cut back to its journaled
+ * length so the next fappend() will not duplicate records.
+ */
+void fappend_recover(char *fname, char *tofname)
+{
+   char jfname[128];
+   off_t off;
+
+   sprintf(jfname, "%s.jnl", tofname);
+   if(read_data(&off, sizeof(off), jfname) != sizeof(off)) {
+      unlink(jfname);
+      return;
+   }
+   if(exists(fname)) {
+      if(truncate(tofname, off) != 0) {
+         error("fappend_recover(): cannot truncate %s", tofname);
+         return;
+      }
+      plog("fappend_recover(): %s cut back to %ld bytes", tofname,
+           (long) off);
+   }
+   unlink(jfname);
+}  /* end fappend_recover() */
+
 #endif /* Not WIN32 */
 
 
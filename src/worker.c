@@ -66,6 +66,7 @@ byte Interval;             /* get_work() poll interval seconds */
 #include "util.c"        /* cross platform support functions */
 #include "sock.c"          /* inet utilities                   */
 #include "connect.c"       /* make outgoing connection         */
+#define EXCLUDE_BSTREAM    /* no block checks in get_block2()  */
 #include "call.c"          /* callserver() and friends         */
 #include "str2ip.c"
 